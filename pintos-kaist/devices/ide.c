@@ -0,0 +1,1074 @@
+#include "devices/ide.h"
+#include <ctype.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/io.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is an interface to an ATA (IDE)
+   controller.  It attempts to comply to [ATA-3].
+
+   Transfers are asynchronous.  disk_submit() adds a request to
+   its channel's queue, and the channel runs the queued requests
+   one at a time, each as one or more READ/WRITE commands.  An I/O
+   scheduler picks which request goes next, and queued requests
+   that continue it on the disk are merged into the same command.
+   The interrupt handler moves the data of a finished block, issues
+   the next command or starts the next request, and calls the
+   completion callbacks.  The synchronous calls submit a request
+   and sleep until it completes.
+
+   If the controller found on the PCI bus supports bus mastering,
+   commands use DMA: the controller copies the data to or from
+   memory by itself and only interrupts when the whole command is
+   done.  Otherwise, and for any command DMA cannot do, data moves
+   by programmed I/O.
+
+   Each ATA disk found is registered with the block layer in
+   disk.c under its name, e.g. "hd0:1", and at the matching
+   position for disk_get(). */
+
+/* ATA command block port addresses. */
+#define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
+#define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error. */
+#define reg_nsect(CHANNEL) ((CHANNEL)->reg_base + 2)    /* Sector Count. */
+#define reg_lbal(CHANNEL) ((CHANNEL)->reg_base + 3)     /* LBA 0:7. */
+#define reg_lbam(CHANNEL) ((CHANNEL)->reg_base + 4)     /* LBA 15:8. */
+#define reg_lbah(CHANNEL) ((CHANNEL)->reg_base + 5)     /* LBA 23:16. */
+#define reg_device(CHANNEL) ((CHANNEL)->reg_base + 6)   /* Device/LBA 27:24. */
+#define reg_status(CHANNEL) ((CHANNEL)->reg_base + 7)   /* Status (r/o). */
+#define reg_command(CHANNEL) reg_status (CHANNEL)       /* Command (w/o). */
+
+/* ATA control block port addresses.
+   (If we supported non-legacy ATA controllers this would not be
+   flexible enough, but it's fine for what we do.) */
+#define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
+#define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
+
+/* Alternate Status Register bits. */
+#define STA_BSY 0x80            /* Busy. */
+#define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Control Register bits. */
+#define CTL_SRST 0x04           /* Software Reset. */
+
+/* Device Register bits. */
+#define DEV_MBS 0xa0            /* Must be set. */
+#define DEV_LBA 0x40            /* Linear based addressing. */
+#define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
+
+/* Commands.
+   Many more are defined but this is the small subset that we
+   use. */
+#define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
+#define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
+#define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE registers, relative to a channel's bm_base. */
+#define BM_COMMAND 0                    /* Command. */
+#define BM_STATUS 2                     /* Status. */
+#define BM_PRDT 4                       /* PRD table physical address. */
+
+/* Bus master command and status bits. */
+#define BM_CMD_START 0x01               /* Start transfer. */
+#define BM_CMD_READ 0x08                /* Transfer from disk to memory. */
+#define BM_STA_ERR 0x02                 /* Transfer failed. */
+#define BM_STA_IRQ 0x04                 /* Interrupt raised. */
+
+/* PCI class of an IDE controller. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+/* Physical region descriptor: one piece of memory in a DMA
+   transfer.  A region may not cross a 64 kB boundary. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last region. */
+};
+#define PRD_EOT 0x8000
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* An ATA device. */
+struct ata_disk {
+	char name[8];               /* Name, e.g. "hd0:1". */
+	struct disk *disk;          /* Block device, if is_ata. */
+	struct channel *channel;    /* Channel disk is on. */
+	int dev_no;                 /* Device 0 or 1 for master or slave. */
+
+	bool is_ata;                /* 1=This device is an ATA disk. */
+	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+	unsigned mult_cnt;          /* Sectors per interrupt for READ/WRITE
+								   MULTIPLE, or 0 if not supported. */
+	bool dma;                   /* Use DMA for this disk? */
+};
+
+/* An ATA channel (aka controller).
+   Each channel can control up to two disks. */
+struct channel {
+	char name[8];               /* Name, e.g. "hd0". */
+	uint16_t reg_base;          /* Base I/O port. */
+	uint8_t irq;                /* Interrupt in use. */
+
+	bool expecting_interrupt;   /* True if an interrupt is expected, false if
+								   any interrupt would be spurious. */
+	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+
+	/* Request queue.  Shared with the interrupt handler, so
+	   accessed only with interrupts off. */
+	struct list queue;          /* Waiting struct disk_requests. */
+	struct disk_request *cur;   /* Request in progress, if any. */
+	struct list batch;          /* Requests merged behind CUR. */
+	disk_sector_t head;         /* Sector after the last command. */
+
+	/* Command in progress. */
+	struct ata_disk *cmd_disk;      /* Disk. */
+	disk_sector_t cmd_sec;      /* First sector. */
+	size_t cmd_cnt;             /* Number of sectors. */
+	size_t cmd_pos;             /* Sectors moved so far by PIO. */
+	bool cmd_write;             /* Write to the disk? */
+	bool cmd_dma;               /* Using DMA? */
+	void *cmd_buffers[DISK_MAX_MULTI];  /* Buffer for each sector. */
+
+	/* Scheduling statistics. */
+	long long request_cnt;      /* Requests dispatched. */
+	long long merge_cnt;        /* Requests merged into another's command. */
+	long long command_cnt;      /* READ/WRITE commands issued. */
+	long long expire_cnt;       /* Requests dispatched past deadline. */
+	long long seek_dist;        /* Sum of sector distances between commands. */
+
+	uint16_t bm_base;           /* Bus master registers, or 0 if no DMA. */
+	struct prd *prdt;           /* PRD table, one page. */
+
+	struct ata_disk devices[2];     /* The devices on this channel. */
+};
+
+/* We support the two "legacy" ATA channels found in a standard PC. */
+#define CHANNEL_CNT 2
+static struct channel channels[CHANNEL_CNT];
+
+/* An I/O scheduler, which orders each channel's queue. */
+struct iosched {
+	const char *name;
+
+	/* Adds R to C's queue. */
+	void (*add) (struct channel *c, struct disk_request *r);
+
+	/* Removes and returns the request C should run next.  C's queue
+	   is not empty. */
+	struct disk_request *(*next) (struct channel *c);
+};
+
+static const struct iosched iosched_noop, iosched_clook, iosched_deadline;
+
+/* Schedulers known to ide_set_scheduler(). */
+static const struct iosched *const ioscheds[] = {
+	&iosched_noop, &iosched_clook, &iosched_deadline,
+};
+
+/* Scheduler in use. */
+static const struct iosched *iosched = &iosched_deadline;
+
+/* Deadline scheduler expiry times, in timer ticks.  Reads expire
+   sooner because a thread is usually waiting for them. */
+#define READ_EXPIRE (TIMER_FREQ / 20)
+#define WRITE_EXPIRE (TIMER_FREQ / 2)
+
+static void reset_channel (struct channel *);
+static bool check_device_type (struct ata_disk *);
+static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, unsigned cnt);
+static void dma_init (void);
+static bool dma_start (struct channel *);
+static bool dma_finish (struct channel *);
+
+static void dispatch (struct channel *);
+static void build_command (struct channel *);
+static void start_command (struct channel *);
+static void advance_request (struct channel *);
+static void complete_command (struct channel *);
+
+static void select_sector (struct ata_disk *, disk_sector_t, size_t cnt);
+static void issue_pio_command (struct channel *, uint8_t command);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sector (struct channel *, void *);
+static void output_sector (struct channel *, const void *);
+
+static void wait_until_idle (const struct ata_disk *);
+static bool wait_while_busy (const struct ata_disk *);
+static void select_device (const struct ata_disk *);
+static void select_device_wait (const struct ata_disk *);
+static uint8_t poll_status (const struct channel *, uint8_t mask);
+
+static void interrupt_handler (struct intr_frame *);
+
+static void ide_submit (struct disk_request *, void *d);
+
+/* Block device operations for ATA disks. */
+static const struct disk_ops ide_ops = {
+	"ata", ide_submit,
+};
+
+/* Detects the ATA disks and registers them with the block
+   layer. */
+void
+ide_init (void) {
+	size_t chan_no;
+
+	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		struct channel *c = &channels[chan_no];
+		int dev_no;
+
+		/* Initialize channel. */
+		snprintf (c->name, sizeof c->name, "hd%zu", chan_no);
+		switch (chan_no) {
+			case 0:
+				c->reg_base = 0x1f0;
+				c->irq = 14 + 0x20;
+				break;
+			case 1:
+				c->reg_base = 0x170;
+				c->irq = 15 + 0x20;
+				break;
+			default:
+				NOT_REACHED ();
+		}
+		c->expecting_interrupt = false;
+		sema_init (&c->completion_wait, 0);
+		list_init (&c->queue);
+		c->cur = NULL;
+		list_init (&c->batch);
+		c->head = 0;
+		c->request_cnt = c->merge_cnt = c->command_cnt = 0;
+		c->expire_cnt = c->seek_dist = 0;
+		c->bm_base = 0;
+		c->prdt = NULL;
+
+		/* Initialize devices. */
+		for (dev_no = 0; dev_no < 2; dev_no++) {
+			struct ata_disk *d = &c->devices[dev_no];
+			snprintf (d->name, sizeof d->name, "%s:%d", c->name, dev_no);
+			d->disk = NULL;
+			d->channel = c;
+			d->dev_no = dev_no;
+
+			d->is_ata = false;
+			d->capacity = 0;
+			d->mult_cnt = 0;
+			d->dma = false;
+		}
+
+		/* Register interrupt handler. */
+		intr_register_ext (c->irq, interrupt_handler, c->name);
+
+		/* Reset hardware. */
+		reset_channel (c);
+
+		/* Distinguish ATA hard disks from other devices. */
+		if (check_device_type (&c->devices[0]))
+			check_device_type (&c->devices[1]);
+
+		/* Read hard disk identity information. */
+		for (dev_no = 0; dev_no < 2; dev_no++)
+			if (c->devices[dev_no].is_ata)
+				identify_ata_device (&c->devices[dev_no]);
+	}
+
+	dma_init ();
+
+	/* Register the disks. */
+	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		int dev_no;
+
+		for (dev_no = 0; dev_no < 2; dev_no++) {
+			struct ata_disk *d = &channels[chan_no].devices[dev_no];
+			if (d->is_ata) {
+				d->disk = disk_register (d->name, d->capacity, &ide_ops, d);
+				disk_set_position (chan_no, dev_no, d->disk);
+			}
+		}
+	}
+}
+
+/* Selects the I/O scheduler named NAME: "noop", "clook" or
+   "deadline".  Must be called before any request is submitted.
+   Returns false if there is no such scheduler. */
+bool
+ide_set_scheduler (const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof ioscheds / sizeof *ioscheds; i++)
+		if (!strcmp (name, ioscheds[i]->name)) {
+			iosched = ioscheds[i];
+			return true;
+		}
+	return false;
+}
+
+/* Prints the scheduling statistics of each channel. */
+void
+ide_print_stats (void) {
+	int chan_no;
+
+	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		struct channel *c = &channels[chan_no];
+
+		if (c->request_cnt > 0)
+			printf ("%s: %s scheduler: %lld requests, %lld merged, "
+					"%lld commands, %lld expired, %lld sectors seek\n",
+					c->name, iosched->name, c->request_cnt, c->merge_cnt,
+					c->command_cnt, c->expire_cnt, c->seek_dist);
+	}
+}
+
+/* Block layer submit operation: adds request R for ATA disk D_ to
+   its channel's queue, and starts it if the channel is idle. */
+static void
+ide_submit (struct disk_request *r, void *d_) {
+	struct ata_disk *d = d_;
+	struct channel *c = d->channel;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	iosched->add (c, r);
+	if (c->cur == NULL)
+		dispatch (c);
+	intr_set_level (old_level);
+}
+
+/* Request dispatch.  Everything here runs with interrupts off,
+   either in the interrupt handler or in disk_submit(), so it
+   polls the controller instead of sleeping. */
+
+/* If channel C is idle, starts the request its scheduler picks. */
+static void
+dispatch (struct channel *c) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (c->cur == NULL && !list_empty (&c->queue)) {
+		c->cur = iosched->next (c);
+		c->request_cnt++;
+		build_command (c);
+		start_command (c);
+	}
+}
+
+/* Returns the ATA disk on channel C that block device D stands
+   for. */
+static struct ata_disk *
+ata_disk_of (struct channel *c, struct disk *d) {
+	return c->devices[0].disk == d ? &c->devices[0] : &c->devices[1];
+}
+
+/* Returns a request in C's queue that moves sectors starting at
+   SEC_NO on disk D in the direction given by WRITE, and has at
+   most MAX_CNT sectors, or a null pointer if there is none. */
+static struct disk_request *
+find_merge (struct channel *c, struct ata_disk *d, disk_sector_t sec_no,
+		bool write, size_t max_cnt) {
+	struct list_elem *e;
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *q = list_entry (e, struct disk_request, elem);
+		if (q->disk == d->disk && q->sec_no == sec_no && q->write == write
+				&& q->cnt <= max_cnt)
+			return q;
+	}
+	return NULL;
+}
+
+/* Sets up channel C's command for the next DISK_MAX_MULTI or fewer
+   sectors of its current request.  If the rest of the request
+   fits, queued requests that continue it on the disk are merged
+   into the same command. */
+static void
+build_command (struct channel *c) {
+	struct disk_request *r = c->cur;
+	size_t left = r->cnt - r->pos;
+	size_t i;
+
+	c->cmd_disk = ata_disk_of (c, r->disk);
+	c->cmd_sec = r->sec_no + r->pos;
+	c->cmd_cnt = left < DISK_MAX_MULTI ? left : DISK_MAX_MULTI;
+	c->cmd_write = r->write;
+	for (i = 0; i < c->cmd_cnt; i++)
+		c->cmd_buffers[i] = r->buffers[r->pos + i];
+
+	if (left <= DISK_MAX_MULTI) {
+		struct disk_request *q;
+
+		while ((q = find_merge (c, c->cmd_disk, c->cmd_sec + c->cmd_cnt,
+						c->cmd_write, DISK_MAX_MULTI - c->cmd_cnt)) != NULL) {
+			list_remove (&q->elem);
+			list_push_back (&c->batch, &q->elem);
+			for (i = 0; i < q->cnt; i++)
+				c->cmd_buffers[c->cmd_cnt++] = q->buffers[i];
+			c->merge_cnt++;
+		}
+	}
+
+	c->seek_dist += (c->cmd_sec > c->head ? c->cmd_sec - c->head
+			: c->head - c->cmd_sec);
+	c->head = c->cmd_sec + c->cmd_cnt;
+}
+
+/* Issues channel C's command, by DMA if possible.  For a PIO
+   write, also sends the first block of data. */
+static void
+start_command (struct channel *c) {
+	struct ata_disk *d = c->cmd_disk;
+
+	c->command_cnt++;
+	c->cmd_pos = 0;
+	c->cmd_dma = dma_start (c);
+	if (c->cmd_dma)
+		return;
+
+	select_sector (d, c->cmd_sec, c->cmd_cnt);
+	if (c->cmd_write) {
+		issue_command (c, d->mult_cnt > 0 ? CMD_WRITE_MULTIPLE
+				: CMD_WRITE_SECTOR_RETRY);
+		advance_request (c);
+	} else
+		issue_command (c, d->mult_cnt > 0 ? CMD_READ_MULTIPLE
+				: CMD_READ_SECTOR_RETRY);
+}
+
+/* Moves the next block of channel C's PIO command through the
+   data register: reads the block the disk has just announced, or
+   sends the next block to write.  Panics if the disk reports an
+   error. */
+static void
+advance_request (struct channel *c) {
+	struct ata_disk *d = c->cmd_disk;
+	size_t block = d->mult_cnt > 0 ? d->mult_cnt : 1;
+	size_t end = c->cmd_pos + block;
+	uint8_t status;
+
+	if (end > c->cmd_cnt)
+		end = c->cmd_cnt;
+
+	status = poll_status (c, STA_BSY);
+	if ((status & STA_ERR) || !(status & STA_DRQ))
+		PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+				c->cmd_write ? "write" : "read",
+				c->cmd_sec + (disk_sector_t) c->cmd_pos);
+
+	for (; c->cmd_pos < end; c->cmd_pos++) {
+		if (c->cmd_write)
+			output_sector (c, c->cmd_buffers[c->cmd_pos]);
+		else
+			input_sector (c, c->cmd_buffers[c->cmd_pos]);
+	}
+}
+
+/* Handles a completion interrupt for channel C's command: moves
+   PIO data, then issues the current request's next command, or
+   completes the requests in the command and starts the next
+   request. */
+static void
+complete_command (struct channel *c) {
+	struct disk_request *r = c->cur;
+	struct ata_disk *d = c->cmd_disk;
+	struct list done;
+
+	if (c->cmd_dma) {
+		if (!dma_finish (c)) {
+			/* dma_finish() turned DMA off for the disk, so this
+			   retries the command by PIO. */
+			start_command (c);
+			return;
+		}
+	} else if (!c->cmd_write || c->cmd_pos < c->cmd_cnt) {
+		/* A read block is ready, or the disk wants the next write
+		   block. */
+		advance_request (c);
+		if (c->cmd_pos < c->cmd_cnt || c->cmd_write)
+			return;
+	} else if (poll_status (c, STA_BSY) & STA_ERR)
+		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, c->cmd_sec);
+
+	if (list_empty (&c->batch)) {
+		r->pos += c->cmd_cnt;
+		if (r->pos < r->cnt) {
+			build_command (c);
+			start_command (c);
+			return;
+		}
+	} else
+		r->pos = r->cnt;
+
+	/* Take the finished requests off the channel before calling
+	   back, because a callback may submit a new request. */
+	list_init (&done);
+	while (!list_empty (&c->batch))
+		list_push_back (&done, list_pop_front (&c->batch));
+	c->cur = NULL;
+
+	r->done (r, r->aux);
+	while (!list_empty (&done)) {
+		struct disk_request *q = list_entry (list_pop_front (&done),
+				struct disk_request, elem);
+		q->pos = q->cnt;
+		q->done (q, q->aux);
+	}
+	dispatch (c);
+}
+
+/* I/O schedulers. */
+
+/* No-op scheduler: runs requests in submission order. */
+static void
+noop_add (struct channel *c, struct disk_request *r) {
+	list_push_back (&c->queue, &r->elem);
+}
+
+static struct disk_request *
+noop_next (struct channel *c) {
+	return list_entry (list_pop_front (&c->queue), struct disk_request, elem);
+}
+
+static const struct iosched iosched_noop = {
+	"noop", noop_add, noop_next,
+};
+
+/* Returns true if request A starts at a lower sector than B. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+	return a->sec_no < b->sec_no;
+}
+
+/* C-LOOK elevator: keeps the queue sorted by sector and sweeps
+   upward from the last command, jumping back to the lowest
+   queued sector at the end of each sweep.  Both disks on a
+   channel share one sweep. */
+static void
+clook_add (struct channel *c, struct disk_request *r) {
+	list_insert_ordered (&c->queue, &r->elem, sector_less, NULL);
+}
+
+static struct disk_request *
+clook_next (struct channel *c) {
+	struct list_elem *e;
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e))
+		if (list_entry (e, struct disk_request, elem)->sec_no >= c->head)
+			break;
+	if (e == list_end (&c->queue))
+		e = list_begin (&c->queue);
+	list_remove (e);
+	return list_entry (e, struct disk_request, elem);
+}
+
+static const struct iosched iosched_clook = {
+	"clook", clook_add, clook_next,
+};
+
+/* Deadline: C-LOOK, except that a request that has waited past
+   its expiry time goes first, the one that expired earliest
+   first of all. */
+static void
+deadline_add (struct channel *c, struct disk_request *r) {
+	r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+	clook_add (c, r);
+}
+
+static struct disk_request *
+deadline_next (struct channel *c) {
+	int64_t now = timer_ticks ();
+	struct disk_request *oldest = NULL;
+	struct list_elem *e;
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		if (r->deadline <= now
+				&& (oldest == NULL || r->deadline < oldest->deadline))
+			oldest = r;
+	}
+	if (oldest == NULL)
+		return clook_next (c);
+
+	c->expire_cnt++;
+	list_remove (&oldest->elem);
+	return oldest;
+}
+
+static const struct iosched iosched_deadline = {
+	"deadline", deadline_add, deadline_next,
+};
+
+/* Disk detection and identification. */
+
+static void print_ata_string (char *string, size_t size);
+
+/* Resets an ATA channel and waits for any devices present on it
+   to finish the reset. */
+static void
+reset_channel (struct channel *c) {
+	bool present[2];
+	int dev_no;
+
+	/* The ATA reset sequence depends on which devices are present,
+	   so we start by detecting device presence. */
+	for (dev_no = 0; dev_no < 2; dev_no++) {
+		struct ata_disk *d = &c->devices[dev_no];
+
+		select_device (d);
+
+		outb (reg_nsect (c), 0x55);
+		outb (reg_lbal (c), 0xaa);
+
+		outb (reg_nsect (c), 0xaa);
+		outb (reg_lbal (c), 0x55);
+
+		outb (reg_nsect (c), 0x55);
+		outb (reg_lbal (c), 0xaa);
+
+		present[dev_no] = (inb (reg_nsect (c)) == 0x55
+				&& inb (reg_lbal (c)) == 0xaa);
+	}
+
+	/* Issue soft reset sequence, which selects device 0 as a side effect.
+	   Also enable interrupts. */
+	outb (reg_ctl (c), 0);
+	timer_usleep (10);
+	outb (reg_ctl (c), CTL_SRST);
+	timer_usleep (10);
+	outb (reg_ctl (c), 0);
+
+	timer_msleep (150);
+
+	/* Wait for device 0 to clear BSY. */
+	if (present[0]) {
+		select_device (&c->devices[0]);
+		wait_while_busy (&c->devices[0]);
+	}
+
+	/* Wait for device 1 to clear BSY. */
+	if (present[1]) {
+		int i;
+
+		select_device (&c->devices[1]);
+		for (i = 0; i < 3000; i++) {
+			if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
+				break;
+			timer_msleep (10);
+		}
+		wait_while_busy (&c->devices[1]);
+	}
+}
+
+/* Checks whether device D is an ATA disk and sets D's is_ata
+   member appropriately.  If D is device 0 (master), returns true
+   if it's possible that a slave (device 1) exists on this
+   channel.  If D is device 1 (slave), the return value is not
+   meaningful. */
+static bool
+check_device_type (struct ata_disk *d) {
+	struct channel *c = d->channel;
+	uint8_t error, lbam, lbah, status;
+
+	select_device (d);
+
+	error = inb (reg_error (c));
+	lbam = inb (reg_lbam (c));
+	lbah = inb (reg_lbah (c));
+	status = inb (reg_status (c));
+
+	if ((error != 1 && (error != 0x81 || d->dev_no == 1))
+			|| (status & STA_DRDY) == 0
+			|| (status & STA_BSY) != 0) {
+		d->is_ata = false;
+		return error != 0x81;
+	} else {
+		d->is_ata = (lbam == 0 && lbah == 0) || (lbam == 0x3c && lbah == 0xc3);
+		return true;
+	}
+}
+
+/* Sends an IDENTIFY DEVICE command to disk D and reads the
+   response.  Initializes D's capacity member based on the result
+   and prints a message describing the disk to the console. */
+static void
+identify_ata_device (struct ata_disk *d) {
+	struct channel *c = d->channel;
+	uint16_t id[DISK_SECTOR_SIZE / 2];
+
+	ASSERT (d->is_ata);
+
+	/* Send the IDENTIFY DEVICE command, wait for an interrupt
+	   indicating the device's response is ready, and read the data
+	   into our buffer. */
+	select_device_wait (d);
+	issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+	sema_down (&c->completion_wait);
+	if (!wait_while_busy (d)) {
+		d->is_ata = false;
+		return;
+	}
+	input_sector (c, id);
+
+	/* Calculate capacity. */
+	d->capacity = id[60] | ((uint32_t) id[61] << 16);
+
+	/* Use the largest block the disk supports for READ/WRITE
+	   MULTIPLE, and DMA if the disk supports it. */
+	set_multiple_mode (d, id[47] & 0xff);
+	d->dma = (id[49] & 0x0100) != 0;
+
+	/* Print identification message. */
+	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
+	if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
+		printf ("%"PRDSNu" GB",
+				d->capacity / (1024 / DISK_SECTOR_SIZE * 1024 * 1024));
+	else if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024)
+		printf ("%"PRDSNu" MB", d->capacity / (1024 / DISK_SECTOR_SIZE * 1024));
+	else if (d->capacity > 1024 / DISK_SECTOR_SIZE)
+		printf ("%"PRDSNu" kB", d->capacity / (1024 / DISK_SECTOR_SIZE));
+	else
+		printf ("%"PRDSNu" byte", d->capacity * DISK_SECTOR_SIZE);
+	printf (") disk, model \"");
+	print_ata_string ((char *) &id[27], 40);
+	printf ("\", serial \"");
+	print_ata_string ((char *) &id[10], 20);
+	printf ("\"\n");
+}
+
+/* Sends a SET MULTIPLE MODE command to disk D so that READ and
+   WRITE MULTIPLE move CNT sectors per interrupt.  Leaves
+   multiple mode off if CNT is 0 or the disk rejects it. */
+static void
+set_multiple_mode (struct ata_disk *d, unsigned cnt) {
+	struct channel *c = d->channel;
+
+	d->mult_cnt = 0;
+	if (cnt == 0)
+		return;
+
+	select_device_wait (d);
+	outb (reg_nsect (c), cnt);
+	issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	if (!(inb (reg_status (c)) & STA_ERR))
+		d->mult_cnt = cnt;
+}
+
+/* Bus master DMA. */
+
+/* Finds the IDE controller on the PCI bus and, if it can act as a
+   bus master, sets up each channel for DMA. */
+static void
+dma_init (void) {
+	struct pci_device pd;
+	uint32_t bar;
+	size_t chan_no;
+
+	if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pd)
+			|| !(pd.prog_if & 0x80))
+		return;
+	bar = pci_read_config (&pd, PCI_REG_BAR (4));
+	if (!(bar & 1) || (bar & ~3u) == 0)
+		return;
+
+	pci_write_config (&pd, PCI_REG_COMMAND,
+			pci_read_config (&pd, PCI_REG_COMMAND)
+			| PCI_CMD_IO | PCI_CMD_MASTER);
+
+	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		struct channel *c = &channels[chan_no];
+
+		c->prdt = palloc_get_page (0);
+		if (c->prdt == NULL)
+			continue;
+		c->bm_base = (bar & ~3u) + 8 * chan_no;
+		printf ("%s: bus master DMA at port %#x\n", c->name, c->bm_base);
+	}
+}
+
+/* Fills in the PRD table of channel C for the CNT sectors in
+   BUFFERS.  Returns false if some buffer cannot be reached by
+   DMA. */
+static bool
+build_prdt (struct channel *c, const void *const buffers[], size_t cnt) {
+	size_t i, n = 0;
+
+	for (i = 0; i < cnt; i++) {
+		uint64_t addr = vtop (buffers[i]);
+		size_t left = DISK_SECTOR_SIZE;
+
+		if ((addr & 1) || addr + DISK_SECTOR_SIZE > 0xffffffff)
+			return false;
+		while (left > 0) {
+			size_t size = 0x10000 - (addr & 0xffff);
+			if (size > left)
+				size = left;
+			if (n == PRD_CNT)
+				return false;
+			c->prdt[n].addr = addr;
+			c->prdt[n].size = size;
+			c->prdt[n].flags = 0;
+			n++;
+			addr += size;
+			left -= size;
+		}
+	}
+	c->prdt[n - 1].flags = PRD_EOT;
+	return true;
+}
+
+/* Starts channel C's command by DMA.  Returns false, having
+   started nothing, if DMA is not available for it; the command
+   must then use PIO. */
+static bool
+dma_start (struct channel *c) {
+	struct ata_disk *d = c->cmd_disk;
+	uint8_t dir = c->cmd_write ? 0 : BM_CMD_READ;
+
+	if (!d->dma || c->bm_base == 0
+			|| !build_prdt (c, (const void *const *) c->cmd_buffers,
+				c->cmd_cnt))
+		return false;
+
+	outb (c->bm_base + BM_COMMAND, dir);
+	outb (c->bm_base + BM_STATUS, BM_STA_ERR | BM_STA_IRQ);
+	outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+
+	select_sector (d, c->cmd_sec, c->cmd_cnt);
+	issue_command (c, c->cmd_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (c->bm_base + BM_COMMAND, dir | BM_CMD_START);
+	return true;
+}
+
+/* Stops the DMA engine after the completion interrupt for channel
+   C's command.  Returns true if the command succeeded.  Otherwise
+   turns DMA off for the command's disk and returns false. */
+static bool
+dma_finish (struct channel *c) {
+	struct ata_disk *d = c->cmd_disk;
+	uint8_t dir = c->cmd_write ? 0 : BM_CMD_READ;
+	uint8_t status;
+
+	status = inb (c->bm_base + BM_STATUS);
+	outb (c->bm_base + BM_COMMAND, dir);
+	outb (c->bm_base + BM_STATUS, BM_STA_ERR | BM_STA_IRQ);
+	if ((status & BM_STA_ERR) || (poll_status (c, STA_BSY) & STA_ERR)) {
+		printf ("%s: DMA failed, falling back to PIO\n", d->name);
+		d->dma = false;
+		return false;
+	}
+	return true;
+}
+
+/* Prints STRING, which consists of SIZE bytes in a funky format:
+   each pair of bytes is in reverse order.  Does not print
+   trailing whitespace and/or nulls. */
+static void
+print_ata_string (char *string, size_t size) {
+	size_t i;
+
+	/* Find the last non-white, non-null character. */
+	for (; size > 0; size--) {
+		int c = string[(size - 1) ^ 1];
+		if (c != '\0' && !isspace (c))
+			break;
+	}
+
+	/* Print. */
+	for (i = 0; i < size; i++)
+		printf ("%c", string[i ^ 1]);
+}
+
+/* Selects device D, waiting for it to become ready, and then
+   writes SEC_NO and the sector count CNT, which must be between 1
+   and DISK_MAX_MULTI, to the disk's sector selection registers.
+   (We use LBA mode.) */
+static void
+select_sector (struct ata_disk *d, disk_sector_t sec_no, size_t cnt) {
+	struct channel *c = d->channel;
+	uint8_t dev = DEV_MBS | (d->dev_no == 1 ? DEV_DEV : 0);
+
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_MULTI);
+	ASSERT (sec_no < d->capacity);
+	ASSERT (cnt <= d->capacity - sec_no);
+	ASSERT (sec_no + cnt <= (1UL << 28));
+
+	/* Like select_device_wait(), but without sleeping.  Each read
+	   of the alternate status register takes at least 100 ns, so
+	   four of them give the device the 400 ns it needs. */
+	poll_status (c, STA_BSY | STA_DRQ);
+	outb (reg_device (c), dev);
+	inb (reg_alt_status (c));
+	inb (reg_alt_status (c));
+	inb (reg_alt_status (c));
+	inb (reg_alt_status (c));
+	poll_status (c, STA_BSY | STA_DRQ);
+	outb (reg_nsect (c), cnt & 0xff);       /* 0 means 256. */
+	outb (reg_lbal (c), sec_no);
+	outb (reg_lbam (c), sec_no >> 8);
+	outb (reg_lbah (c), (sec_no >> 16));
+	outb (reg_device (c),
+			DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+}
+
+/* Writes COMMAND to channel C and prepares for receiving a
+   completion interrupt on C's semaphore.  Used only outside the
+   request queue, during disk detection. */
+static void
+issue_pio_command (struct channel *c, uint8_t command) {
+	/* Interrupts must be enabled or our semaphore will never be
+	   up'd by the completion handler. */
+	ASSERT (intr_get_level () == INTR_ON);
+
+	issue_command (c, command);
+}
+
+/* Writes COMMAND to channel C and prepares for receiving a
+   completion interrupt. */
+static void
+issue_command (struct channel *c, uint8_t command) {
+	c->expecting_interrupt = true;
+	outb (reg_command (c), command);
+}
+
+/* Reads a sector from channel C's data register in PIO mode into
+   SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
+static void
+input_sector (struct channel *c, void *sector) {
+	insw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+}
+
+/* Writes SECTOR to channel C's data register in PIO mode.
+   SECTOR must contain DISK_SECTOR_SIZE bytes. */
+static void
+output_sector (struct channel *c, const void *sector) {
+	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+}
+
+/* Low-level ATA primitives. */
+
+/* Wait up to 10 seconds for the controller to become idle, that
+   is, for the BSY and DRQ bits to clear in the status register.
+
+   As a side effect, reading the status register clears any
+   pending interrupt. */
+static void
+wait_until_idle (const struct ata_disk *d) {
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
+			return;
+		timer_usleep (10);
+	}
+
+	printf ("%s: idle timeout\n", d->name);
+}
+
+/* Wait up to 30 seconds for disk D to clear BSY,
+   and then return the status of the DRQ bit.
+   The ATA standards say that a disk may take as long as that to
+   complete its reset. */
+static bool
+wait_while_busy (const struct ata_disk *d) {
+	struct channel *c = d->channel;
+	int i;
+
+	for (i = 0; i < 3000; i++) {
+		if (i == 700)
+			printf ("%s: busy, waiting...", d->name);
+		if (!(inb (reg_alt_status (c)) & STA_BSY)) {
+			if (i >= 700)
+				printf ("ok\n");
+			return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
+		}
+		timer_msleep (10);
+	}
+
+	printf ("failed\n");
+	return false;
+}
+
+/* Program D's channel so that D is now the selected disk. */
+static void
+select_device (const struct ata_disk *d) {
+	struct channel *c = d->channel;
+	uint8_t dev = DEV_MBS;
+	if (d->dev_no == 1)
+		dev |= DEV_DEV;
+	outb (reg_device (c), dev);
+	inb (reg_alt_status (c));
+	timer_nsleep (400);
+}
+
+/* Select disk D in its channel, as select_device(), but wait for
+   the channel to become idle before and after. */
+static void
+select_device_wait (const struct ata_disk *d) {
+	wait_until_idle (d);
+	select_device (d);
+	wait_until_idle (d);
+}
+
+/* Busy-waits until all the bits in MASK are clear in the status
+   of channel C's selected device, or for about a million status
+   reads, and returns the last status read.  Unlike
+   wait_until_idle() and wait_while_busy(), never sleeps, so it may
+   be used with interrupts off.  Reads the alternate status
+   register, so it leaves any pending interrupt alone. */
+static uint8_t
+poll_status (const struct channel *c, uint8_t mask) {
+	uint8_t status = 0;
+	int i;
+
+	for (i = 0; i < 1000000; i++) {
+		status = inb (reg_alt_status (c));
+		if ((status & mask) == 0)
+			break;
+	}
+	return status;
+}
+
+/* ATA interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f) {
+	struct channel *c;
+
+	for (c = channels; c < channels + CHANNEL_CNT; c++)
+		if (f->vec_no == c->irq) {
+			if (c->cur != NULL) {
+				c->expecting_interrupt = false;
+				inb (reg_status (c));               /* Acknowledge interrupt. */
+				complete_command (c);               /* Advance request. */
+			} else if (c->expecting_interrupt) {
+				inb (reg_status (c));               /* Acknowledge interrupt. */
+				sema_up (&c->completion_wait);      /* Wake up waiter. */
+			} else
+				printf ("%s: unexpected interrupt\n", c->name);
+			return;
+		}
+
+	NOT_REACHED ();
+}
@@ -0,0 +1,111 @@
+#include "devices/partition.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+
+/* Partitions: ranges of sectors on a disk, described by a PC
+   (MBR) partition table in its sector 0, that are registered as
+   block devices of their own.  The fourth primary partition of
+   hd0:1, for example, becomes "hd0:1p4".  Extended partitions are
+   not followed. */
+
+/* A partition table entry. */
+struct partition_table_entry {
+	uint8_t bootable;           /* 0x00 = no, 0x80 = bootable. */
+	uint8_t start_chs[3];       /* Encoded starting cylinder, head, sector. */
+	uint8_t type;               /* Partition type, 0 if unused. */
+	uint8_t end_chs[3];         /* Encoded ending cylinder, head, sector. */
+	uint32_t offset;            /* Start sector. */
+	uint32_t size;              /* Number of sectors. */
+} __attribute__((packed));
+
+/* A partition table, as found in sector 0. */
+struct partition_table {
+	uint8_t loader[446];        /* Boot loader. */
+	struct partition_table_entry partitions[4];
+	uint16_t signature;         /* Should be 0xaa55. */
+} __attribute__((packed));
+
+/* A registered partition. */
+struct partition {
+	struct disk *disk;          /* Disk holding the partition. */
+	disk_sector_t start;        /* First sector on DISK. */
+};
+
+static void partition_submit (struct disk_request *, void *p);
+
+/* Block device operations for partitions. */
+static const struct disk_ops partition_ops = {
+	"partition", partition_submit,
+};
+
+/* Returns true if TYPE is an extended partition type. */
+static bool
+is_extended (uint8_t type) {
+	return type == 0x05 || type == 0x0f || type == 0x85;
+}
+
+/* Reads the partition table of disk D, if it has one, and
+   registers each valid primary partition in it. */
+void
+partition_scan (struct disk *d) {
+	struct partition_table *pt;
+	disk_sector_t capacity = disk_size (d);
+	int i;
+
+	if (capacity == 0)
+		return;
+
+	pt = malloc (sizeof *pt);
+	if (pt == NULL)
+		PANIC ("%s: out of memory reading partition table", disk_name (d));
+	disk_read (d, 0, pt);
+
+	if (pt->signature == 0xaa55)
+		for (i = 0; i < 4; i++) {
+			struct partition_table_entry *e = &pt->partitions[i];
+			struct partition *p;
+			char name[8];
+
+			if (e->type == 0)
+				continue;
+			if ((e->bootable != 0x00 && e->bootable != 0x80)
+					|| e->size == 0 || e->offset == 0
+					|| e->offset >= capacity || e->size > capacity - e->offset) {
+				printf ("%s: invalid partition %d, ignored\n", disk_name (d), i + 1);
+				continue;
+			}
+			if (is_extended (e->type)) {
+				printf ("%s: extended partition %d, ignored\n",
+						disk_name (d), i + 1);
+				continue;
+			}
+
+			if ((size_t) snprintf (name, sizeof name, "%sp%d", disk_name (d),
+						i + 1) >= sizeof name)
+				continue;
+			p = malloc (sizeof *p);
+			if (p == NULL)
+				PANIC ("%s: out of memory registering partition", name);
+			p->disk = d;
+			p->start = e->offset;
+			disk_register (name, e->size, &partition_ops, p);
+			printf ("%s: %'"PRIu32" sectors at sector %'"PRIu32
+					", type %#04x\n", name, e->size, e->offset, e->type);
+		}
+
+	free (pt);
+}
+
+/* Block layer submit operation: passes request R for partition P_
+   on to the disk holding it. */
+static void
+partition_submit (struct disk_request *r, void *p_) {
+	struct partition *p = p_;
+
+	r->disk = p->disk;
+	r->sec_no += p->start;
+	disk_submit (r);
+}
@@ -0,0 +1,117 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   through the legacy configuration mechanism #1 (I/O ports 0xcf8
+   and 0xcfc).  It is just enough to find devices and program
+   them. */
+
+#define PCI_CONFIG_ADDR 0xcf8   /* Configuration address port. */
+#define PCI_CONFIG_DATA 0xcfc   /* Configuration data port. */
+
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Selects register REG of the function at BUS:DEV.FUNC. */
+static void
+select_reg (uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11)
+			| (func << 8) | (reg & 0xfc));
+}
+
+static uint32_t
+read_reg (uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg) {
+	select_reg (bus, dev, func, reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Returns the 32-bit configuration register REG of PD. */
+uint32_t
+pci_read_config (const struct pci_device *pd, uint8_t reg) {
+	ASSERT (pd != NULL);
+	return read_reg (pd->bus, pd->dev, pd->func, reg);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of PD. */
+void
+pci_write_config (const struct pci_device *pd, uint8_t reg, uint32_t value) {
+	ASSERT (pd != NULL);
+	select_reg (pd->bus, pd->dev, pd->func, reg);
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Calls CALLBACK for each function on the PCI buses, in bus order,
+   passing AUX along, until CALLBACK returns false. */
+void
+pci_scan (pci_scan_func *callback, void *aux) {
+	unsigned bus, dev, func;
+
+	for (bus = 0; bus < PCI_BUS_CNT; bus++)
+		for (dev = 0; dev < PCI_DEV_CNT; dev++)
+			for (func = 0; func < PCI_FUNC_CNT; func++) {
+				uint32_t id = read_reg (bus, dev, func, PCI_REG_ID);
+				uint32_t cls;
+				struct pci_device pd;
+
+				if ((id & 0xffff) == 0xffff) {
+					/* No function here; if function 0 is missing,
+					   the whole device is. */
+					if (func == 0)
+						break;
+					continue;
+				}
+
+				cls = read_reg (bus, dev, func, PCI_REG_CLASS);
+				pd.bus = bus;
+				pd.dev = dev;
+				pd.func = func;
+				pd.class = cls >> 24;
+				pd.subclass = (cls >> 16) & 0xff;
+				pd.prog_if = (cls >> 8) & 0xff;
+				pd.vendor_id = id & 0xffff;
+				pd.device_id = id >> 16;
+				if (!callback (&pd, aux))
+					return;
+
+				/* Single-function devices only have function 0. */
+				if (func == 0
+						&& !(read_reg (bus, dev, 0, PCI_REG_HEADER) & 0x800000))
+					break;
+			}
+}
+
+/* pci_find_class() search state. */
+struct find_class {
+	uint8_t class, subclass;    /* What to look for. */
+	struct pci_device *pd;      /* Where to store it. */
+	bool found;                 /* Found yet? */
+};
+
+static bool
+find_class (const struct pci_device *pd, void *fc_) {
+	struct find_class *fc = fc_;
+
+	if (pd->class == fc->class && pd->subclass == fc->subclass) {
+		*fc->pd = *pd;
+		fc->found = true;
+		return false;
+	}
+	return true;
+}
+
+/* Searches the PCI buses for the first function with the given CLASS
+   and SUBCLASS.  If one is found, fills in *PD and returns true;
+   otherwise returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *pd) {
+	struct find_class fc;
+
+	fc.class = class;
+	fc.subclass = subclass;
+	fc.pd = pd;
+	fc.found = false;
+	pci_scan (find_class, &fc);
+	return fc.found;
+}
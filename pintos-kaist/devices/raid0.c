@@ -0,0 +1,332 @@
+#include "devices/raid0.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Software RAID-0: a virtual disk, "md0", whose sectors are striped
+   across two or more member disks, ideally on different ATA
+   channels.  Virtual sectors are grouped into stripes of
+   STRIPE_SECTORS sectors, and stripe S is stored on member
+   S % MEMBER_CNT.  A large request is split into one request per
+   member, and since each channel has its own queue and interrupt,
+   the members work on their parts at the same time.
+
+   The array is set up on the kernel command line, e.g.
+   "-raid0=hd0:1,hd1:1 -stripe=16", and is then used like any other
+   disk, e.g. with "-filesys=md0".  The "raid0-bench" action compares
+   the array's read throughput with that of its members. */
+
+/* Most member disks. */
+#define MAX_MEMBERS 4
+
+/* Most sectors of a request handled at once.  Longer requests are
+   handled in pieces. */
+#define PIECE_SECTORS 256
+
+/* Pieces that may be in flight at once. */
+#define SLOT_CNT 8
+
+/* Sectors that raid0_bench() reads from each disk, and per request. */
+#define BENCH_SECTORS 8192
+#define BENCH_REQ_SECTORS 128
+
+/* A piece of a request in flight: one request per member. */
+struct raid0_slot {
+	bool busy;                  /* In use? */
+	struct disk_request *r;     /* Request this is part of. */
+	size_t cnt;                 /* Sectors of R in this piece. */
+	int pending;                /* Member requests not yet done. */
+	struct disk_request subs[MAX_MEMBERS];  /* Member requests. */
+	void *buffers[PIECE_SECTORS];   /* Buffers, grouped by member. */
+};
+
+/* Configuration. */
+static char member_names[MAX_MEMBERS][8];
+static int member_cnt;
+static disk_sector_t stripe_sectors = 16;
+
+/* The array.  Driver state is shared with interrupt handlers, so
+   it is accessed only with interrupts off. */
+static struct disk *members[MAX_MEMBERS];
+static struct raid0_slot *slots;
+static struct list pending;     /* Requests not yet wholly issued. */
+static size_t pending_pos;      /* Sectors issued of the first one. */
+static bool issuing;            /* Is issue_pending() running? */
+
+static void submit (struct disk_request *, void *aux);
+static void issue_pending (void);
+static void bench_disk (struct disk *, void **buffers);
+
+/* Block device operations for the array. */
+static const struct disk_ops raid0_ops = {
+	"raid0", submit,
+};
+
+/* Parses LIST, a comma-separated list of two to MAX_MEMBERS disk
+   names, and records them as the members of the array.
+   Returns false if LIST is malformed.  The array is created
+   later, by raid0_init(). */
+bool
+raid0_configure (const char *list) {
+	int cnt = 0;
+
+	while (*list != '\0') {
+		size_t len = strcspn (list, ",");
+
+		if (cnt >= MAX_MEMBERS || len == 0 || len >= sizeof *member_names)
+			return false;
+		memcpy (member_names[cnt], list, len);
+		member_names[cnt][len] = '\0';
+		cnt++;
+
+		list += len;
+		if (*list == ',')
+			list++;
+	}
+	if (cnt < 2)
+		return false;
+	member_cnt = cnt;
+	return true;
+}
+
+/* Sets the stripe size of the array to SECTORS, a decimal number
+   of sectors.  Returns false if it is not a positive number. */
+bool
+raid0_set_stripe (const char *sectors) {
+	int cnt = atoi (sectors);
+
+	if (cnt <= 0)
+		return false;
+	stripe_sectors = cnt;
+	return true;
+}
+
+/* Creates the array configured with raid0_configure(), if any,
+   and registers it as disk "md0". */
+void
+raid0_init (void) {
+	disk_sector_t member_size = 0;
+	int i;
+
+	if (member_cnt == 0)
+		return;
+
+	for (i = 0; i < member_cnt; i++) {
+		members[i] = disk_get_by_name (member_names[i]);
+		if (members[i] == NULL) {
+			printf ("md0: no member disk %s, array not created\n",
+					member_names[i]);
+			return;
+		}
+		if (i == 0 || disk_size (members[i]) < member_size)
+			member_size = disk_size (members[i]);
+	}
+	member_size -= member_size % stripe_sectors;
+	if (member_size == 0) {
+		printf ("md0: member disks smaller than one stripe\n");
+		return;
+	}
+
+	slots = calloc (SLOT_CNT, sizeof *slots);
+	if (slots == NULL) {
+		printf ("md0: out of memory\n");
+		return;
+	}
+	list_init (&pending);
+	pending_pos = 0;
+
+	disk_register ("md0", member_size * member_cnt, &raid0_ops, NULL);
+	printf ("md0: RAID-0 of %d disks, %'"PRDSNu"-sector stripes, "
+			"%'"PRDSNu" sectors\n",
+			member_cnt, stripe_sectors, member_size * member_cnt);
+}
+
+/* Returns the member holding virtual sector SEC_NO, and stores the
+   sector's number on that member in *MEMBER_SEC. */
+static int
+map_sector (disk_sector_t sec_no, disk_sector_t *member_sec) {
+	disk_sector_t stripe = sec_no / stripe_sectors;
+
+	*member_sec = stripe / member_cnt * stripe_sectors
+		+ sec_no % stripe_sectors;
+	return stripe % member_cnt;
+}
+
+/* Block layer submit operation: queues request R for the array
+   and issues as much of it as there are free slots for. */
+static void
+submit (struct disk_request *r, void *aux UNUSED) {
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	list_push_back (&pending, &r->elem);
+	issue_pending ();
+	intr_set_level (old_level);
+}
+
+/* Completion callback for a member request of slot SLOT_.  Once
+   all of the slot's member requests are done, frees the slot,
+   completes the array request if this was its last piece, and
+   issues more pending pieces. */
+static void
+member_done (struct disk_request *sub UNUSED, void *slot_) {
+	struct raid0_slot *slot = slot_;
+	struct disk_request *r = slot->r;
+
+	if (--slot->pending > 0)
+		return;
+
+	slot->busy = false;
+	r->pos += slot->cnt;
+	if (r->pos == r->cnt)
+		r->done (r, r->aux);
+	issue_pending ();
+}
+
+/* Splits the next piece of the first pending request across the
+   members and submits one request to each member involved.  Member
+   sectors for a piece are consecutive, because each member's
+   stripes are stored back to back.  Repeats until nothing is
+   pending or all slots are busy.  Interrupts must be off.
+
+   A member that completes a request at once, such as a RAM disk,
+   calls member_done() and so this function again from within
+   disk_submit().  Such a nested call returns at once; the loop
+   that is already running picks up the slot it freed. */
+static void
+issue_pending (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (issuing)
+		return;
+	issuing = true;
+
+	while (!list_empty (&pending)) {
+		struct disk_request *r = list_entry (list_front (&pending),
+				struct disk_request, elem);
+		size_t left = r->cnt - pending_pos;
+		size_t cnt = left < PIECE_SECTORS ? left : PIECE_SECTORS;
+		disk_sector_t first = r->sec_no + pending_pos;
+		size_t counts[MAX_MEMBERS], fill[MAX_MEMBERS];
+		struct raid0_slot *slot = NULL;
+		size_t i;
+		int m;
+
+		for (i = 0; i < SLOT_CNT; i++)
+			if (!slots[i].busy) {
+				slot = &slots[i];
+				break;
+			}
+		if (slot == NULL)
+			break;
+
+		/* Count each member's sectors, and point its request at
+		   its share of the slot's buffers. */
+		for (m = 0; m < member_cnt; m++)
+			counts[m] = 0;
+		for (i = 0; i < cnt; i++) {
+			disk_sector_t member_sec;
+			counts[map_sector (first + i, &member_sec)]++;
+		}
+		slot->busy = true;
+		slot->r = r;
+		slot->cnt = cnt;
+		slot->pending = 0;
+		for (m = 0, i = 0; m < member_cnt; i += counts[m], m++) {
+			struct disk_request *sub = &slot->subs[m];
+
+			sub->disk = members[m];
+			sub->cnt = counts[m];
+			sub->buffers = slot->buffers + i;
+			sub->write = r->write;
+			sub->done = member_done;
+			sub->aux = slot;
+			fill[m] = 0;
+			if (counts[m] > 0)
+				slot->pending++;
+		}
+
+		/* Distribute the buffers. */
+		for (i = 0; i < cnt; i++) {
+			disk_sector_t member_sec;
+
+			m = map_sector (first + i, &member_sec);
+			if (fill[m] == 0)
+				slot->subs[m].sec_no = member_sec;
+			slot->subs[m].buffers[fill[m]++] = r->buffers[pending_pos + i];
+		}
+
+		pending_pos += cnt;
+		if (pending_pos == r->cnt) {
+			list_pop_front (&pending);
+			pending_pos = 0;
+		}
+
+		/* Submit last, since a member may complete a request at
+		   once and call back into member_done(). */
+		for (m = 0; m < member_cnt; m++)
+			if (counts[m] > 0)
+				disk_submit (&slot->subs[m]);
+	}
+
+	issuing = false;
+}
+
+/* "raid0-bench" action.  Reads BENCH_SECTORS sectors sequentially,
+   BENCH_REQ_SECTORS at a time, from each member disk on its own and
+   then from md0, and prints the throughput of each.  With members on
+   different channels, md0 should approach the sum of its members'. */
+void
+raid0_bench (char **argv UNUSED) {
+	size_t page_cnt = BENCH_REQ_SECTORS * DISK_SECTOR_SIZE / PGSIZE;
+	struct disk *md = disk_get_by_name ("md0");
+	void *buffers[BENCH_REQ_SECTORS];
+	uint8_t *pages;
+	int i;
+
+	if (md == NULL) {
+		printf ("raid0-bench: no md0 (use -raid0)\n");
+		return;
+	}
+	pages = palloc_get_multiple (PAL_ASSERT, page_cnt);
+	for (i = 0; i < BENCH_REQ_SECTORS; i++)
+		buffers[i] = pages + i * DISK_SECTOR_SIZE;
+
+	for (i = 0; i < member_cnt; i++)
+		bench_disk (members[i], buffers);
+	bench_disk (md, buffers);
+
+	palloc_free_multiple (pages, page_cnt);
+}
+
+/* Reads the first BENCH_SECTORS sectors of D, or all of D if it is
+   smaller, into BUFFERS and prints the throughput. */
+static void
+bench_disk (struct disk *d, void **buffers) {
+	disk_sector_t cnt = disk_size (d) < BENCH_SECTORS
+		? disk_size (d) : BENCH_SECTORS;
+	disk_sector_t sec_no;
+	int64_t start, ticks;
+
+	start = timer_ticks ();
+	for (sec_no = 0; sec_no < cnt; sec_no += BENCH_REQ_SECTORS) {
+		size_t n = cnt - sec_no < BENCH_REQ_SECTORS
+			? cnt - sec_no : BENCH_REQ_SECTORS;
+		disk_read_multi (d, sec_no, n, buffers);
+	}
+	ticks = timer_elapsed (start);
+	if (ticks == 0)
+		ticks = 1;
+
+	printf ("raid0-bench: %s: %'"PRDSNu" sectors in %lld ticks, "
+			"%lld kB/s\n", disk_name (d), cnt, (long long) ticks,
+			(long long) cnt * DISK_SECTOR_SIZE / 1024 * TIMER_FREQ / ticks);
+}
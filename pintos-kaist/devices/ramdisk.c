@@ -0,0 +1,131 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* RAM disks: disks whose sectors live in kernel pages.  A RAM disk
+   is registered with the block layer at one of the ATA disk
+   positions, so the file system, scratch or swap disk can be put in memory
+   without changing the code that uses it.  Its contents start out
+   zeroed and are lost at power off.
+
+   RAM disks are requested on the kernel command line, e.g.
+   "-ramdisk=swap:4" for a 4 MB swap disk. */
+
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk {
+	char name[8];               /* Name, e.g. "rd1:1". */
+	size_t size_mb;             /* Requested size in MB, 0 if unused. */
+	uint8_t **pages;            /* SECTORS_PER_PAGE sectors per page. */
+};
+
+/* One possible RAM disk per disk position: hd0:0, hd0:1, hd1:0,
+   hd1:1. */
+#define RAMDISK_CNT 4
+static struct ramdisk ramdisks[RAMDISK_CNT];
+
+/* Names for the positions a RAM disk may take, as in disk_get(). */
+static const char *const position_names[RAMDISK_CNT] = {
+	NULL, "fs", "scratch", "swap",
+};
+
+static void submit (struct disk_request *, void *rd);
+
+/* Block device operations for RAM disks. */
+static const struct disk_ops ramdisk_ops = {
+	"ram", submit,
+};
+
+/* Parses SPEC, of the form "DISK:MB", and records that a RAM disk
+   of MB megabytes should stand in for DISK: "fs", "scratch" or
+   "swap".  Returns false if SPEC is malformed.  The disk is
+   created later, by ramdisk_init(). */
+bool
+ramdisk_configure (const char *spec) {
+	const char *colon = strchr (spec, ':');
+	int pos;
+
+	if (colon == NULL || atoi (colon + 1) <= 0)
+		return false;
+	for (pos = 0; pos < RAMDISK_CNT; pos++)
+		if (position_names[pos] != NULL
+				&& strlen (position_names[pos]) == (size_t) (colon - spec)
+				&& !memcmp (position_names[pos], spec, colon - spec)) {
+			ramdisks[pos].size_mb = atoi (colon + 1);
+			return true;
+		}
+	return false;
+}
+
+/* Creates the RAM disks requested with ramdisk_configure(). */
+void
+ramdisk_init (void) {
+	int pos;
+
+	for (pos = 0; pos < RAMDISK_CNT; pos++) {
+		struct ramdisk *rd = &ramdisks[pos];
+		disk_sector_t capacity;
+		size_t page_cnt, i;
+
+		if (rd->size_mb == 0)
+			continue;
+
+		capacity = rd->size_mb * (1024 * 1024 / DISK_SECTOR_SIZE);
+		page_cnt = DIV_ROUND_UP (capacity, SECTORS_PER_PAGE);
+		rd->pages = calloc (page_cnt, sizeof *rd->pages);
+		for (i = 0; rd->pages != NULL && i < page_cnt; i++)
+			if ((rd->pages[i] = palloc_get_page (PAL_ZERO)) == NULL) {
+				while (i-- > 0)
+					palloc_free_page (rd->pages[i]);
+				free (rd->pages);
+				rd->pages = NULL;
+			}
+		if (rd->pages == NULL) {
+			printf ("ramdisk: not enough memory for %zu MB %s disk\n",
+					rd->size_mb, position_names[pos]);
+			continue;
+		}
+
+		snprintf (rd->name, sizeof rd->name, "rd%d:%d", pos / 2, pos % 2);
+		disk_set_position (pos / 2, pos % 2,
+				disk_register (rd->name, capacity, &ramdisk_ops, rd));
+		printf ("%s: %zu MB RAM disk for %s\n",
+				rd->name, rd->size_mb, position_names[pos]);
+	}
+}
+
+/* Block layer submit operation: copies request R's sectors to or
+   from RAM disk RD_ and completes it at once. */
+static void
+submit (struct disk_request *r, void *rd_) {
+	struct ramdisk *rd = rd_;
+	enum intr_level old_level;
+	size_t i;
+
+	for (i = 0; i < r->cnt; i++) {
+		disk_sector_t sec_no = r->sec_no + i;
+		uint8_t *sector = rd->pages[sec_no / SECTORS_PER_PAGE]
+			+ sec_no % SECTORS_PER_PAGE * DISK_SECTOR_SIZE;
+
+		if (r->write)
+			memcpy (sector, r->buffers[i], DISK_SECTOR_SIZE);
+		else
+			memcpy (r->buffers[i], sector, DISK_SECTOR_SIZE);
+	}
+	r->pos = r->cnt;
+
+	/* Completion callbacks expect to run with interrupts off, as
+	   they do for real disks. */
+	old_level = intr_disable ();
+	r->done (r, r->aux);
+	intr_set_level (old_level);
+}
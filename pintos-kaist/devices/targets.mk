@@ -2,6 +2,12 @@ devices_SRC  = devices/timer.c		# Timer device.
 devices_SRC += devices/kbd.c		# Keyboard device.
 devices_SRC += devices/vga.c		# Video device.
 devices_SRC += devices/serial.c		# Serial port device.
-devices_SRC += devices/disk.c		# IDE disk device.
+devices_SRC += devices/disk.c		# Block device layer.
+devices_SRC += devices/ide.c		# IDE disk device.
+devices_SRC += devices/partition.c	# Partition table parsing.
+devices_SRC += devices/raid0.c		# Software RAID-0.
+devices_SRC += devices/pci.c		# PCI configuration space.
+devices_SRC += devices/virtio-blk.c	# virtio block device.
+devices_SRC += devices/ramdisk.c	# RAM disk.
 devices_SRC += devices/input.c		# Serial and keyboard input.
 devices_SRC += devices/intq.c		# Interrupt queue.
@@ -0,0 +1,456 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A driver for virtio block devices through the legacy virtio PCI
+   interface [VIRTIO-0.9.5].  Each device has one queue of
+   descriptor rings shared with the host.  A request is a chain of
+   descriptors: a header giving the direction and first sector,
+   one descriptor per sector buffer, and a status byte that the
+   host fills in.  Any number of requests may be in flight, and a
+   single notification tells the host about all the requests added
+   since the last one.  The host interrupts once it has completed
+   one or more of them.
+
+   Each device is registered with the block layer and takes over
+   one of the four ATA disk positions, so the rest of the kernel
+   uses it with disk_get() and disk_read() like any other disk. */
+
+#define VIRTIO_VENDOR 0x1af4            /* Vendor ID of all virtio devices. */
+#define VIRTIO_BLK_DEVICE 0x1001        /* Legacy block device ID. */
+
+/* Legacy virtio registers, relative to the I/O port base in BAR 0. */
+#define VIRTIO_REG_HOST_FEATURES 0x00   /* Features the device offers. */
+#define VIRTIO_REG_GUEST_FEATURES 0x04  /* Features the driver uses. */
+#define VIRTIO_REG_QUEUE_PFN 0x08       /* Queue page frame number. */
+#define VIRTIO_REG_QUEUE_SIZE 0x0c      /* Queue size (r/o). */
+#define VIRTIO_REG_QUEUE_SELECT 0x0e    /* Queue that the above refer to. */
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10    /* Write queue number to notify. */
+#define VIRTIO_REG_STATUS 0x12          /* Device status. */
+#define VIRTIO_REG_ISR 0x13             /* Interrupt status; read clears. */
+#define VIRTIO_REG_CAPACITY 0x14        /* Capacity in sectors, 64 bits. */
+
+/* Device status bits. */
+#define VIRTIO_STA_ACK 0x01             /* Driver has noticed the device. */
+#define VIRTIO_STA_DRIVER 0x02          /* Driver knows how to drive it. */
+#define VIRTIO_STA_DRIVER_OK 0x04       /* Driver is ready. */
+#define VIRTIO_STA_FAILED 0x80          /* Driver gave up. */
+
+/* Interrupt status bits. */
+#define VIRTIO_ISR_QUEUE 0x01           /* Used ring was updated. */
+
+/* Descriptor flags. */
+#define VRING_DESC_NEXT 0x01            /* NEXT is valid. */
+#define VRING_DESC_WRITE 0x02           /* Host writes the buffer. */
+
+/* The legacy interface aligns the used ring to a page. */
+#define VRING_ALIGN 4096
+
+/* Block request types and status. */
+#define VIRTIO_BLK_T_IN 0               /* Read. */
+#define VIRTIO_BLK_T_OUT 1              /* Write. */
+#define VIRTIO_BLK_S_OK 0               /* Success. */
+
+/* Most sectors in one virtio request. */
+#define VBLK_MAX_SEGS 128
+
+/* Descriptor table entry. */
+struct vring_desc {
+	uint64_t addr;              /* Physical address of buffer. */
+	uint32_t len;               /* Length of buffer. */
+	uint16_t flags;             /* VRING_DESC_*. */
+	uint16_t next;              /* Next descriptor in chain. */
+};
+
+/* Available ring, written by the driver. */
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes. */
+	uint16_t ring[];            /* Heads of descriptor chains. */
+};
+
+/* Used ring entry. */
+struct vring_used_elem {
+	uint32_t id;                /* Head of completed descriptor chain. */
+	uint32_t len;               /* Bytes written by the host. */
+};
+
+/* Used ring, written by the host. */
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes. */
+	struct vring_used_elem ring[];
+};
+
+/* Header of a block request. */
+struct vblk_header {
+	uint32_t type;              /* VIRTIO_BLK_T_*. */
+	uint32_t reserved;
+	uint64_t sector;            /* First sector. */
+};
+
+/* A virtio request in flight, carrying part or all of a disk
+   request.  Indexed by the head of its descriptor chain. */
+struct vblk_slot {
+	struct vblk_header header;  /* Read by the host. */
+	uint8_t status;             /* Written by the host. */
+	struct disk_request *r;     /* Request this is part of. */
+	size_t cnt;                 /* Number of sectors. */
+};
+
+/* A virtio block device. */
+struct vblk {
+	char name[8];               /* Name, e.g. "vd0:1". */
+	struct disk *disk;          /* Disk it stands in for. */
+	uint16_t io_base;           /* Base I/O port. */
+	uint8_t irq;                /* Interrupt in use. */
+
+	/* Queue 0, shared with the host. */
+	uint16_t qsize;             /* Number of descriptors. */
+	struct vring_desc *desc;    /* Descriptor table. */
+	struct vring_avail *avail;  /* Available ring. */
+	struct vring_used *used;    /* Used ring. */
+	uint16_t last_used;         /* Used ring entries processed. */
+
+	/* Driver state.  Shared with the interrupt handler, so
+	   accessed only with interrupts off. */
+	uint16_t free_head;         /* First free descriptor. */
+	uint16_t free_cnt;          /* Number of free descriptors. */
+	size_t max_segs;            /* Most sectors per virtio request. */
+	struct vblk_slot *slots;    /* One per descriptor. */
+	struct list pending;        /* Requests not yet wholly issued. */
+	size_t pending_pos;         /* Sectors issued of the first one. */
+
+	long long notify_cnt;       /* Notifications sent. */
+	long long request_cnt;      /* Virtio requests issued. */
+};
+
+/* Devices found. */
+#define VBLK_CNT 4
+static struct vblk vblks[VBLK_CNT];
+static size_t vblk_cnt;
+
+static bool probe (const struct pci_device *, void *aux);
+static bool setup (struct vblk *, const struct pci_device *);
+static void submit (struct disk_request *, void *vb);
+
+/* Block device operations for virtio disks. */
+static const struct disk_ops vblk_ops = {
+	"virtio", submit,
+};
+static void issue_pending (struct vblk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and initializes the virtio block devices on the PCI
+   bus. */
+void
+virtio_blk_init (void) {
+	pci_scan (probe, NULL);
+}
+
+/* Prints statistics for each virtio block device. */
+void
+virtio_blk_print_stats (void) {
+	size_t i;
+
+	for (i = 0; i < vblk_cnt; i++)
+		printf ("%s: %lld virtio requests, %lld notifications\n",
+				vblks[i].name, vblks[i].request_cnt, vblks[i].notify_cnt);
+}
+
+/* pci_scan() callback: sets up PD if it is a virtio block
+   device. */
+static bool
+probe (const struct pci_device *pd, void *aux UNUSED) {
+	if (pd->vendor_id == VIRTIO_VENDOR && pd->device_id == VIRTIO_BLK_DEVICE
+			&& vblk_cnt < VBLK_CNT && setup (&vblks[vblk_cnt], pd))
+		vblk_cnt++;
+	return true;
+}
+
+/* Returns the number of bytes in a legacy queue of QSIZE
+   descriptors. */
+static size_t
+vring_size (unsigned qsize) {
+	return (ROUND_UP (sizeof (struct vring_desc) * qsize
+				+ sizeof (struct vring_avail) + sizeof (uint16_t) * (qsize + 1),
+				VRING_ALIGN)
+			+ ROUND_UP (sizeof (struct vring_used)
+				+ sizeof (struct vring_used_elem) * qsize + sizeof (uint16_t),
+				VRING_ALIGN));
+}
+
+/* Returns the disk position a device in PCI slot DEV should take:
+   the one utils/pintos meant if DEV is one of its slots, otherwise
+   the first one without a disk.  Returns -1 if none is left. */
+static int
+pick_position (uint8_t dev) {
+	int pos;
+
+	if (dev >= VIRTIO_BLK_SLOT (0) && dev < VIRTIO_BLK_SLOT (4))
+		return dev - VIRTIO_BLK_SLOT (0);
+	for (pos = 0; pos < 4; pos++)
+		if (disk_get (pos / 2, pos % 2) == NULL)
+			return pos;
+	return -1;
+}
+
+/* Initializes VB for the device PD, sets up its queue, and
+   attaches it as a disk.  Returns true if successful. */
+static bool
+setup (struct vblk *vb, const struct pci_device *pd) {
+	static bool irq_registered[16];
+	uint32_t bar = pci_read_config (pd, PCI_REG_BAR (0));
+	uint8_t line = pci_read_config (pd, PCI_REG_INTR) & 0xff;
+	uint64_t capacity;
+	size_t page_cnt;
+	uint8_t *mem;
+	int pos;
+	unsigned i;
+
+	if (!(bar & 1) || line >= 16 || (pos = pick_position (pd->dev)) < 0)
+		return false;
+	vb->io_base = bar & ~3u;
+	vb->irq = 0x20 + line;
+
+	pci_write_config (pd, PCI_REG_COMMAND,
+			pci_read_config (pd, PCI_REG_COMMAND)
+			| PCI_CMD_IO | PCI_CMD_MASTER);
+
+	/* Reset the device, then tell it we are here and that we need
+	   none of its optional features. */
+	outb (vb->io_base + VIRTIO_REG_STATUS, 0);
+	outb (vb->io_base + VIRTIO_REG_STATUS, VIRTIO_STA_ACK);
+	outb (vb->io_base + VIRTIO_REG_STATUS, VIRTIO_STA_ACK | VIRTIO_STA_DRIVER);
+	inl (vb->io_base + VIRTIO_REG_HOST_FEATURES);
+	outl (vb->io_base + VIRTIO_REG_GUEST_FEATURES, 0);
+
+	/* Set up queue 0 in physically contiguous, zeroed pages. */
+	outw (vb->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+	vb->qsize = inw (vb->io_base + VIRTIO_REG_QUEUE_SIZE);
+	if (vb->qsize < 3)
+		goto fail;
+	page_cnt = DIV_ROUND_UP (vring_size (vb->qsize), PGSIZE);
+	mem = palloc_get_multiple (PAL_ZERO, page_cnt);
+	vb->slots = calloc (vb->qsize, sizeof *vb->slots);
+	if (mem == NULL || vb->slots == NULL) {
+		if (mem != NULL)
+			palloc_free_multiple (mem, page_cnt);
+		free (vb->slots);
+		goto fail;
+	}
+	vb->desc = (struct vring_desc *) mem;
+	vb->avail = (struct vring_avail *) (mem
+			+ sizeof (struct vring_desc) * vb->qsize);
+	vb->used = (struct vring_used *) (mem
+			+ ROUND_UP (sizeof (struct vring_desc) * vb->qsize
+				+ sizeof (struct vring_avail)
+				+ sizeof (uint16_t) * (vb->qsize + 1), VRING_ALIGN));
+	vb->last_used = 0;
+	for (i = 0; i < vb->qsize; i++)
+		vb->desc[i].next = i + 1;
+	vb->free_head = 0;
+	vb->free_cnt = vb->qsize;
+	vb->max_segs = vb->qsize - 2 < VBLK_MAX_SEGS ? vb->qsize - 2
+		: VBLK_MAX_SEGS;
+	list_init (&vb->pending);
+	vb->pending_pos = 0;
+	vb->notify_cnt = vb->request_cnt = 0;
+	outl (vb->io_base + VIRTIO_REG_QUEUE_PFN, vtop (mem) / VRING_ALIGN);
+
+	/* Take over the disk position. */
+	capacity = inl (vb->io_base + VIRTIO_REG_CAPACITY)
+		| (uint64_t) inl (vb->io_base + VIRTIO_REG_CAPACITY + 4) << 32;
+	if (capacity > UINT32_MAX)
+		capacity = UINT32_MAX;
+	/* POS is below 4, so channel and device are single digits. */
+	snprintf (vb->name, sizeof vb->name, "vd%c:%c", '0' + pos / 2,
+			'0' + pos % 2);
+	vb->disk = disk_register (vb->name, capacity, &vblk_ops, vb);
+	disk_set_position (pos / 2, pos % 2, vb->disk);
+
+	if (!irq_registered[line]) {
+		intr_register_ext (vb->irq, interrupt_handler, "virtio-blk");
+		irq_registered[line] = true;
+	}
+	outb (vb->io_base + VIRTIO_REG_STATUS,
+			VIRTIO_STA_ACK | VIRTIO_STA_DRIVER | VIRTIO_STA_DRIVER_OK);
+
+	printf ("%s: virtio-blk, %'"PRDSNu" sectors, %u-entry queue\n",
+			vb->name, (disk_sector_t) capacity, vb->qsize);
+	return true;
+
+fail:
+	outb (vb->io_base + VIRTIO_REG_STATUS, VIRTIO_STA_FAILED);
+	return false;
+}
+
+/* Block layer submit operation: queues request R for device VB_
+   and issues as much of it as the queue has room for. */
+static void
+submit (struct disk_request *r, void *vb_) {
+	struct vblk *vb = vb_;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	list_push_back (&vb->pending, &r->elem);
+	issue_pending (vb);
+	intr_set_level (old_level);
+}
+
+/* Removes and returns a free descriptor of VB. */
+static uint16_t
+alloc_desc (struct vblk *vb) {
+	uint16_t i = vb->free_head;
+
+	ASSERT (vb->free_cnt > 0);
+	vb->free_head = vb->desc[i].next;
+	vb->free_cnt--;
+	return i;
+}
+
+/* Frees the descriptor chain that starts at HEAD in VB. */
+static void
+free_chain (struct vblk *vb, uint16_t head) {
+	uint16_t i = head;
+
+	for (;;) {
+		struct vring_desc *desc = &vb->desc[i];
+		bool more = desc->flags & VRING_DESC_NEXT;
+		uint16_t next = desc->next;
+
+		desc->next = vb->free_head;
+		vb->free_head = i;
+		vb->free_cnt++;
+		if (!more)
+			break;
+		i = next;
+	}
+}
+
+/* Issues virtio requests for VB's pending requests until they
+   have all been issued or the queue is full, then notifies the
+   host once about all of them.  Interrupts must be off. */
+static void
+issue_pending (struct vblk *vb) {
+	bool added = false;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (!list_empty (&vb->pending)) {
+		struct disk_request *r = list_entry (list_front (&vb->pending),
+				struct disk_request, elem);
+		size_t left = r->cnt - vb->pending_pos;
+		size_t cnt = left < vb->max_segs ? left : vb->max_segs;
+		uint16_t head, prev, i;
+		struct vblk_slot *slot;
+		size_t j;
+
+		if (vb->free_cnt < cnt + 2)
+			break;
+
+		/* Header. */
+		head = alloc_desc (vb);
+		slot = &vb->slots[head];
+		slot->header.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+		slot->header.reserved = 0;
+		slot->header.sector = r->sec_no + vb->pending_pos;
+		slot->status = 0xff;
+		slot->r = r;
+		slot->cnt = cnt;
+		vb->desc[head].addr = vtop (&slot->header);
+		vb->desc[head].len = sizeof slot->header;
+		vb->desc[head].flags = VRING_DESC_NEXT;
+		prev = head;
+
+		/* One descriptor per sector. */
+		for (j = 0; j < cnt; j++) {
+			i = alloc_desc (vb);
+			vb->desc[i].addr = vtop (r->buffers[vb->pending_pos + j]);
+			vb->desc[i].len = DISK_SECTOR_SIZE;
+			vb->desc[i].flags = VRING_DESC_NEXT
+				| (r->write ? 0 : VRING_DESC_WRITE);
+			vb->desc[prev].next = i;
+			prev = i;
+		}
+
+		/* Status. */
+		i = alloc_desc (vb);
+		vb->desc[i].addr = vtop (&slot->status);
+		vb->desc[i].len = sizeof slot->status;
+		vb->desc[i].flags = VRING_DESC_WRITE;
+		vb->desc[prev].next = i;
+
+		/* Make the chain available.  The host must see the ring
+		   entry before the index that covers it. */
+		vb->avail->ring[vb->avail->idx % vb->qsize] = head;
+		barrier ();
+		vb->avail->idx++;
+		vb->request_cnt++;
+		added = true;
+
+		vb->pending_pos += cnt;
+		if (vb->pending_pos == r->cnt) {
+			list_pop_front (&vb->pending);
+			vb->pending_pos = 0;
+		}
+	}
+
+	if (added) {
+		barrier ();
+		outw (vb->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+		vb->notify_cnt++;
+	}
+}
+
+/* Processes the requests VB's host has completed: frees their
+   descriptors, completes the disk requests they finish, and
+   issues pending requests into the freed space. */
+static void
+complete_used (struct vblk *vb) {
+	while (vb->last_used != *(volatile uint16_t *) &vb->used->idx) {
+		struct vring_used_elem *e;
+		struct vblk_slot *slot;
+		struct disk_request *r;
+
+		barrier ();
+		e = &vb->used->ring[vb->last_used % vb->qsize];
+		slot = &vb->slots[e->id];
+		r = slot->r;
+		if (slot->status != VIRTIO_BLK_S_OK)
+			PANIC ("%s: disk %s failed, sector=%"PRIu64, vb->name,
+					r->write ? "write" : "read", slot->header.sector);
+
+		r->pos += slot->cnt;
+		slot->r = NULL;
+		free_chain (vb, e->id);
+		vb->last_used++;
+		if (r->pos == r->cnt)
+			r->done (r, r->aux);
+	}
+	issue_pending (vb);
+}
+
+/* Virtio interrupt handler.  Devices may share an interrupt line,
+   so checks every device on it. */
+static void
+interrupt_handler (struct intr_frame *f) {
+	size_t i;
+
+	for (i = 0; i < vblk_cnt; i++) {
+		struct vblk *vb = &vblks[i];
+		if (vb->irq == f->vec_no
+				&& (inb (vb->io_base + VIRTIO_REG_ISR) & VIRTIO_ISR_QUEUE))
+			complete_used (vb);
+	}
+}
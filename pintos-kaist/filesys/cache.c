@@ -0,0 +1,500 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.
+ * Keeps the CACHE_SIZE most recently used sectors of the file system disk
+ * in memory. Sectors are found through a hash table keyed by sector
+ * number and replaced with the clock algorithm. Writes only dirty the
+ * cached copy; dirty sectors reach the disk when they are evicted, every
+ * FLUSH_INTERVAL ticks, and at filesys_done().
+ *
+ * Sectors written with cache_write_meta() hold file system metadata.
+ * While the journal is active it decides when they are written: they
+ * are handed to journal_log() instead of being written home, and a miss
+ * checks the journal for a copy newer than the disk's.
+ *
+ * Sequential readers also queue the sectors they are about to read with
+ * cache_readahead(). A worker thread loads them in the background, so
+ * the reader finds them already cached. Consecutive queued sectors are
+ * read with one multi-sector request, up to RA_BATCH at a time.
+ *
+ * No disk I/O happens under the cache lock. A miss, whether on demand or
+ * by the read-ahead worker, claims an entry for the sector and marks it
+ * loading, then drops the lock to write back the entry's old contents
+ * and read the new ones; anyone who wants either sector meanwhile waits
+ * for the load, and everyone else goes on using the cache. A flush
+ * copies the dirty sectors aside and writes the copies without the lock,
+ * keeping their entries from being evicted until the writes are done. */
+
+/* How often dirty sectors are written behind, in timer ticks. */
+#define FLUSH_INTERVAL (2 * TIMER_FREQ)
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;              /* Element in cache_map. */
+	disk_sector_t sector;               /* Cached sector. */
+	bool valid;                         /* Holds a sector? */
+	bool dirty;                         /* Modified since read or written? */
+	bool accessed;                      /* Used since the clock hand passed? */
+	bool meta;                          /* Metadata, written via journal? */
+	bool loading;                       /* Being read in without the lock? */
+	bool writing;                       /* Being flushed from a copy? */
+
+	/* Old contents that a loading entry writes back before it reads. */
+	bool wb_pending;                    /* Not yet written back? */
+	bool wb_meta;                       /* Hand it to the journal? */
+	disk_sector_t wb_sector;            /* Sector it belongs to. */
+
+	uint8_t *data;                      /* DISK_SECTOR_SIZE bytes of data. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static uint8_t cache_data[CACHE_SIZE][DISK_SECTOR_SIZE];
+static struct hash cache_map;           /* Valid entries, by sector. */
+static size_t clock_hand;               /* Next entry to consider evicting. */
+
+/* Read-ahead queue, a ring of sectors waiting for the worker.
+ * Requests are dropped when it is full. */
+#define RA_QUEUE_SIZE 64
+#define RA_BATCH 16                     /* Most sectors read at once. */
+static disk_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_tail;         /* Next to take, next free slot. */
+static struct condition ra_nonempty;    /* Signaled when a sector is queued. */
+static struct condition io_done;        /* Signaled when an entry's I/O
+                                           finishes. */
+
+static struct lock cache_lock;          /* Protects everything above. */
+
+/* Serializes cache_flush(), so that an older copy of a sector never
+ * reaches the disk after a newer one. */
+static struct lock flush_lock;
+static uint8_t flush_data[CACHE_SIZE][DISK_SECTOR_SIZE];
+
+/* Statistics. */
+static long long hit_cnt;               /* # of accesses found in cache. */
+static long long miss_cnt;              /* # of accesses that read or filled. */
+static long long readahead_cnt;         /* # of sectors read ahead. */
+
+static uint64_t cache_hash (const struct hash_elem *, void *);
+static bool cache_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static struct cache_entry *cache_lookup (disk_sector_t);
+static struct cache_entry *cache_get (disk_sector_t, bool need_read);
+static struct cache_entry *cache_claim (disk_sector_t);
+static void cache_load (struct cache_entry *[], size_t cnt, bool need_read);
+static bool cache_writing_back (disk_sector_t);
+static void cache_flushd (void *aux);
+static void cache_readaheadd (void *aux);
+
+/* Initializes the buffer cache and starts the write-behind thread. */
+void
+cache_init (void) {
+	size_t i;
+
+	hash_init (&cache_map, cache_hash, cache_less, NULL);
+	lock_init (&cache_lock);
+	lock_init (&flush_lock);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		cache[i].valid = false;
+		cache[i].loading = false;
+		cache[i].writing = false;
+		cache[i].wb_pending = false;
+		cache[i].data = cache_data[i];
+	}
+	clock_hand = 0;
+	ra_head = ra_tail = 0;
+	cond_init (&ra_nonempty);
+	cond_init (&io_done);
+
+	thread_create ("cache_flushd", PRI_DEFAULT, cache_flushd, NULL);
+	thread_create ("cache_readaheadd", PRI_DEFAULT, cache_readaheadd, NULL);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR into BUFFER. */
+void
+cache_read (disk_sector_t sector, void *buffer, size_t ofs, size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, true);
+	memcpy (buffer, e->data + ofs, size);
+	lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR starting at byte OFS.
+ * The write reaches the disk later; see cache_flush().
+ * Any image of SECTOR that the journal holds, such as the zeros a newly
+ * allocated data sector starts with, is revoked, so that committing it
+ * cannot overwrite the data. This happens with the cache lock held,
+ * before anyone can flush the data home. */
+void
+cache_write (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	e->dirty = true;
+	e->meta = false;
+	journal_revoke (sector, 1);
+	lock_release (&cache_lock);
+}
+
+/* Like cache_write(), but for a metadata sector, which reaches the disk
+ * through the journal if it is active. */
+void
+cache_write_meta (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	if (!journal_active ()) {
+		cache_write (sector, buffer, ofs, size);
+		return;
+	}
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	e->dirty = true;
+	e->meta = true;
+	lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead worker to bring SECTOR into the cache.
+ * Returns immediately. Does nothing if SECTOR is already cached or the
+ * queue is full. */
+void
+cache_readahead (disk_sector_t sector) {
+	lock_acquire (&cache_lock);
+	if (cache_lookup (sector) == NULL
+			&& (ra_tail + 1) % RA_QUEUE_SIZE != ra_head) {
+		ra_queue[ra_tail] = sector;
+		ra_tail = (ra_tail + 1) % RA_QUEUE_SIZE;
+		cond_signal (&ra_nonempty, &cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty cached sector to disk, except metadata while the
+ * journal is active. Runs of consecutive sectors go out as one
+ * multi-sector write.
+ * The sectors are copied aside under the cache lock and written from the
+ * copies without it. Their entries stay cached meanwhile, so that no
+ * miss reads a sector from disk before its write lands, and may be
+ * dirtied again, in which case the next flush writes them. */
+void
+cache_flush (void) {
+	struct cache_entry *dirty[CACHE_SIZE];
+	const void *run[CACHE_SIZE];
+	bool journaled = journal_active ();
+	size_t cnt = 0, i, j;
+
+	lock_acquire (&flush_lock);
+	lock_acquire (&cache_lock);
+
+	/* Collect the dirty entries, sorted by sector. */
+	for (i = 0; i < CACHE_SIZE; i++)
+		if (cache[i].valid && cache[i].dirty && !cache[i].loading
+				&& !(cache[i].meta && journaled)) {
+			struct cache_entry *e = &cache[i];
+			for (j = cnt; j > 0 && dirty[j - 1]->sector > e->sector; j--)
+				dirty[j] = dirty[j - 1];
+			dirty[j] = e;
+			cnt++;
+		}
+
+	/* Snapshot them. */
+	for (i = 0; i < cnt; i++) {
+		memcpy (flush_data[i], dirty[i]->data, DISK_SECTOR_SIZE);
+		dirty[i]->dirty = false;
+		dirty[i]->writing = true;
+	}
+	lock_release (&cache_lock);
+
+	/* Write them a run at a time. */
+	for (i = 0; i < cnt; i = j) {
+		for (j = i; j < cnt && dirty[j]->sector == dirty[i]->sector + (j - i);
+				j++)
+			run[j - i] = flush_data[j];
+		disk_write_multi (filesys_disk, dirty[i]->sector, j - i, run);
+	}
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < cnt; i++)
+		dirty[i]->writing = false;
+	if (cnt > 0)
+		cond_broadcast (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+	lock_release (&flush_lock);
+}
+
+/* Hands every dirty metadata sector to the journal, including any that
+ * an eviction is still writing back. */
+void
+cache_flush_meta (void) {
+	size_t i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		while (cache[i].wb_pending && cache[i].wb_meta)
+			cond_wait (&io_done, &cache_lock);
+		if (cache[i].valid && cache[i].dirty && cache[i].meta
+				&& !cache[i].loading) {
+			journal_log (cache[i].sector, cache[i].data);
+			cache[i].dirty = false;
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+	long long total = hit_cnt + miss_cnt;
+
+	printf ("Buffer cache: %lld hits, %lld misses (%lld%% hit rate), "
+			"%lld read ahead\n", hit_cnt, miss_cnt,
+			total > 0 ? hit_cnt * 100 / total : 0, readahead_cnt);
+}
+
+/* Returns the entry caching SECTOR, or a null pointer.
+ * The cache lock must be held. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find (&cache_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Returns the entry for SECTOR, bringing it into the cache if needed.
+ * The sector is read from disk on a miss only if NEED_READ is true;
+ * otherwise the caller is about to overwrite the whole sector.
+ * Waits out a load of SECTOR that is still in progress, and a write-back
+ * of an older copy of it.
+ * The cache lock must be held. It is dropped and reacquired on a miss. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool need_read) {
+	struct cache_entry *e;
+
+	for (;;) {
+		e = cache_lookup (sector);
+		if (e != NULL && !e->loading) {
+			hit_cnt++;
+			break;
+		}
+		if (e != NULL || cache_writing_back (sector)) {
+			cond_wait (&io_done, &cache_lock);
+			continue;
+		}
+		e = cache_claim (sector);
+		if (e != NULL) {
+			miss_cnt++;
+			cache_load (&e, 1, need_read);
+			break;
+		}
+	}
+	e->accessed = true;
+	return e;
+}
+
+/* Evicts an entry and indexes it under SECTOR, which must not be cached,
+ * marking it loading for the caller to fill in with cache_load().
+ * The new entry starts out not accessed, so read-ahead that is never used
+ * is the first to go.
+ * Returns a null pointer, after waiting for some I/O to finish, if every
+ * entry is busy; the caller must then look SECTOR up again.
+ * The cache lock must be held. */
+static struct cache_entry *
+cache_claim (disk_sector_t sector) {
+	struct cache_entry *e;
+	size_t i;
+
+	/* Run the clock to find a victim, preferring never-used entries.
+	 * An entry with I/O in progress is not a candidate. */
+	for (i = 0; ; i++) {
+		if (i == 2 * CACHE_SIZE) {
+			cond_wait (&io_done, &cache_lock);
+			return NULL;
+		}
+		e = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % CACHE_SIZE;
+		if (!e->valid)
+			break;
+		if (e->loading || e->writing)
+			continue;
+		if (!e->accessed)
+			break;
+		e->accessed = false;
+	}
+
+	/* Leave the victim's dirty data for cache_load() to write back, and
+	 * drop it from the index. */
+	if (e->valid) {
+		if (e->dirty) {
+			e->wb_pending = true;
+			e->wb_meta = e->meta && journal_active ();
+			e->wb_sector = e->sector;
+		}
+		hash_delete (&cache_map, &e->elem);
+	}
+
+	e->sector = sector;
+	e->valid = true;
+	e->dirty = false;
+	e->accessed = false;
+	e->meta = false;
+	e->loading = true;
+	hash_insert (&cache_map, &e->elem);
+	return e;
+}
+
+/* Fills the CNT entries in ES, just returned by cache_claim() for
+ * consecutive sectors, with their sectors: writes back the old contents
+ * they still hold, then reads the sectors if NEED_READ is true and zeroes
+ * them otherwise. A sector the journal holds a newer copy of comes from
+ * the journal; the rest are read from disk a run at a time, with one
+ * request per run.
+ * Drops the cache lock for the I/O. */
+static void
+cache_load (struct cache_entry *es[], size_t cnt, bool need_read) {
+	void *run[RA_BATCH];
+	size_t i, j;
+
+	ASSERT (cnt >= 1 && cnt <= RA_BATCH);
+
+	lock_release (&cache_lock);
+	for (i = 0; i < cnt; i++) {
+		struct cache_entry *e = es[i];
+
+		ASSERT (e->loading);
+		ASSERT (e->sector == es[0]->sector + i);
+		if (e->wb_pending) {
+			if (e->wb_meta)
+				journal_log (e->wb_sector, e->data);
+			else
+				disk_write (filesys_disk, e->wb_sector, e->data);
+		}
+	}
+	if (need_read) {
+		for (i = 0; i < cnt; i = j) {
+			for (j = i; j < cnt && !journal_read (es[j]->sector, es[j]->data);
+					j++)
+				run[j - i] = es[j]->data;
+			if (j > i)
+				disk_read_multi (filesys_disk, es[i]->sector, j - i, run);
+			if (j < cnt)
+				j++;
+		}
+	} else
+		for (i = 0; i < cnt; i++)
+			memset (es[i]->data, 0, DISK_SECTOR_SIZE);
+	lock_acquire (&cache_lock);
+
+	for (i = 0; i < cnt; i++) {
+		es[i]->wb_pending = false;
+		es[i]->loading = false;
+	}
+	cond_broadcast (&io_done, &cache_lock);
+}
+
+/* Returns true if an entry that used to cache SECTOR is still writing it
+ * back, so that its copy on disk is not yet current.
+ * The cache lock must be held. */
+static bool
+cache_writing_back (disk_sector_t sector) {
+	size_t i;
+
+	for (i = 0; i < CACHE_SIZE; i++)
+		if (cache[i].wb_pending && cache[i].wb_sector == sector)
+			return true;
+	return false;
+}
+
+/* Write-behind thread. Flushes dirty sectors every FLUSH_INTERVAL ticks
+ * so that a crash loses a bounded amount of data. */
+static void
+cache_flushd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		cache_flush ();
+	}
+}
+
+/* Read-ahead worker. Takes sectors off the read-ahead queue and loads
+ * those that are not yet cached, like a miss but without marking them
+ * accessed. A sector that directly follows the previous one joins its
+ * batch, so a sequential reader's window is read with one request. */
+static void
+cache_readaheadd (void *aux UNUSED) {
+	lock_acquire (&cache_lock);
+	for (;;) {
+		struct cache_entry *batch[RA_BATCH];
+		size_t cnt = 0;
+
+		while (ra_head == ra_tail)
+			cond_wait (&ra_nonempty, &cache_lock);
+
+		/* Claim entries for a run of queued sectors. Once a claim has
+		 * had to wait, the queue may have changed, so the run ends. */
+		while (ra_head != ra_tail && cnt < RA_BATCH) {
+			disk_sector_t sector = ra_queue[ra_head];
+			struct cache_entry *e;
+
+			if (cnt > 0 && sector != batch[0]->sector + cnt)
+				break;
+			if (cache_lookup (sector) != NULL
+					|| cache_writing_back (sector)) {
+				ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+				if (cnt > 0)
+					break;
+				continue;
+			}
+			e = cache_claim (sector);
+			if (e == NULL) {
+				if (cnt > 0)
+					break;
+				continue;
+			}
+			ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+			batch[cnt++] = e;
+		}
+		if (cnt > 0) {
+			cache_load (batch, cnt, true);
+			readahead_cnt += cnt;
+		}
+	}
+}
+
+/* Returns a hash value for cache entry E. */
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_entry *c = hash_entry (e, struct cache_entry, elem);
+	return hash_int (c->sector);
+}
+
+/* Returns true if cache entry A precedes B. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cache_entry *a = hash_entry (a_, struct cache_entry, elem);
+	const struct cache_entry *b = hash_entry (b_, struct cache_entry, elem);
+	return a->sector < b->sector;
+}
@@ -0,0 +1,169 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Dentry cache.
+ * Remembers the results of recent directory lookups, keyed by the
+ * directory's inode sector and the name looked up, so that repeated
+ * opens of the same path do not search the directory again. Lookups
+ * that found nothing are cached too, as entries whose sector is
+ * DCACHE_NONE. dir_add() and dir_remove() keep the cache current, and
+ * the least recently used entry is replaced when it is full.
+ *
+ * Entries for a directory are inserted only with its directory lock held
+ * (see inode_lock_dir()), the same lock under which dir_lookup() searches
+ * it. Otherwise a lookup that searched before a concurrent dir_add()
+ * could cache its stale "no such file" after dir_add() cached the file. */
+
+/* A cached lookup. */
+struct dentry {
+	struct hash_elem elem;              /* Element in dcache_map. */
+	struct list_elem lru_elem;          /* Element in lru_list. */
+	bool valid;                         /* In dcache_map? */
+	disk_sector_t dir;                  /* Sector of directory's inode. */
+	char name[NAME_MAX + 1];            /* Name looked up. */
+	disk_sector_t sector;               /* Result, or DCACHE_NONE. */
+};
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache_map;          /* Valid entries, by (dir, name). */
+static struct list lru_list;            /* All entries, most recent first. */
+static struct lock dcache_lock;         /* Protects everything above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* # of lookups answered. */
+static long long negative_cnt;          /* # of those that were negative. */
+static long long miss_cnt;              /* # of lookups not cached. */
+
+static uint64_t dentry_hash (const struct hash_elem *, void *);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static struct dentry *dentry_find (disk_sector_t dir, const char *name);
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void) {
+	size_t i;
+
+	hash_init (&dcache_map, dentry_hash, dentry_less, NULL);
+	list_init (&lru_list);
+	lock_init (&dcache_lock);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		dentries[i].valid = false;
+		list_push_back (&lru_list, &dentries[i].lru_elem);
+	}
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+ * Returns false if the result is not cached. Otherwise returns true
+ * and sets *SECTORP to the sector of NAME's inode, or to DCACHE_NONE
+ * if DIR is known to contain no file named NAME. */
+bool
+dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *sectorp) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dentry_find (dir, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&lru_list, &d->lru_elem);
+		*sectorp = d->sector;
+		hit_cnt++;
+		if (d->sector == DCACHE_NONE)
+			negative_cnt++;
+	} else
+		miss_cnt++;
+	lock_release (&dcache_lock);
+
+	return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR has
+ * its inode in SECTOR, or does not exist if SECTOR is DCACHE_NONE.
+ * Names too long to exist are not cached.
+ * The caller must hold DIR's directory lock. */
+void
+dcache_insert (disk_sector_t dir, const char *name, disk_sector_t sector) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	d = dentry_find (dir, name);
+	if (d == NULL) {
+		/* Replace the least recently used entry. */
+		d = list_entry (list_back (&lru_list), struct dentry, lru_elem);
+		if (d->valid)
+			hash_delete (&dcache_map, &d->elem);
+		d->dir = dir;
+		strlcpy (d->name, name, sizeof d->name);
+		d->valid = true;
+		hash_insert (&dcache_map, &d->elem);
+	}
+	d->sector = sector;
+	list_remove (&d->lru_elem);
+	list_push_front (&lru_list, &d->lru_elem);
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every lookup made in the directory whose inode is in sector
+ * DIR, whose contents are no longer what was cached. */
+void
+dcache_purge (disk_sector_t dir) {
+	size_t i;
+
+	lock_acquire (&dcache_lock);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		struct dentry *d = &dentries[i];
+		if (d->valid && d->dir == dir) {
+			hash_delete (&dcache_map, &d->elem);
+			d->valid = false;
+			list_remove (&d->lru_elem);
+			list_push_back (&lru_list, &d->lru_elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void) {
+	printf ("Dentry cache: %lld hits (%lld negative), %lld misses\n",
+			hit_cnt, negative_cnt, miss_cnt);
+}
+
+/* Returns the valid entry for NAME in DIR, or a null pointer. */
+static struct dentry *
+dentry_find (disk_sector_t dir, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	key.dir = dir;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, elem);
+	return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, elem);
+	if (a->dir != b->dir)
+		return a->dir < b->dir;
+	return strcmp (a->name, b->name) < 0;
+}
@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -19,11 +23,109 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Identifies a directory header. */
+#define DIR_MAGIC 0x44495248
+
+/* Directory header, stored in the directory's first sector.
+ *
+ * The rest of the directory is a sequence of sector-sized blocks of
+ * entries, numbered from 1. Small directories have no index
+ * (BUCKET_CNT is 0) and are searched block by block. Once a directory
+ * outgrows DIR_LINEAR_BLOCKS it is rebuilt as a hash table: blocks 1
+ * through BUCKET_CNT are buckets, selected by hash_string() of the
+ * name, and a bucket that fills up chains to overflow blocks appended
+ * after them. */
+struct dir_header {
+	unsigned magic;                     /* Magic number. */
+	uint32_t entry_cnt;                 /* Number of entries in use. */
+	uint32_t block_cnt;                 /* Number of entry blocks. */
+	uint32_t bucket_cnt;                /* Hash buckets, 0 if unindexed. */
+};
+
+/* Entries per block. */
+#define DIR_BLOCK_ENTRIES 25
+
+/* A block of directory entries. */
+struct dir_block {
+	struct dir_entry entries[DIR_BLOCK_ENTRIES];
+	uint32_t next;                      /* Next block in chain, or 0. */
+	uint8_t unused[8];                  /* Not used. */
+};
+
+/* Largest directory, in blocks, that is searched without an index. */
+#define DIR_LINEAR_BLOCKS 2
+
+/* Bucket count of a newly indexed directory. */
+#define DIR_MIN_BUCKETS 8
+
+/* Result of searching a directory for a name. */
+struct dir_slot {
+	off_t ofs;                          /* Offset of entry, if found. */
+	off_t free_ofs;                     /* First free slot seen, or -1. */
+	uint32_t tail;                      /* Last block searched. */
+};
+
+/* Returns the byte offset of entry IDX in block BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx) {
+	return block * DISK_SECTOR_SIZE + idx * sizeof (struct dir_entry);
+}
+
+static bool
+read_header (struct inode *inode, struct dir_header *h) {
+	return inode_read_at (inode, h, sizeof *h, 0) == sizeof *h
+		&& h->magic == DIR_MAGIC;
+}
+
+static bool
+write_header (struct inode *inode, const struct dir_header *h) {
+	return inode_write_at (inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+static bool
+read_block (struct inode *inode, uint32_t block, struct dir_block *b) {
+	return inode_read_at (inode, b, sizeof *b, block * DISK_SECTOR_SIZE)
+		== sizeof *b;
+}
+
+static bool
+write_block (struct inode *inode, uint32_t block, const struct dir_block *b) {
+	return inode_write_at (inode, b, sizeof *b, block * DISK_SECTOR_SIZE)
+		== sizeof *b;
+}
+
+/* Returns the bucket block for NAME in a directory with header H. */
+static uint32_t
+bucket_of (const struct dir_header *h, const char *name) {
+	return 1 + hash_string (name) % h->bucket_cnt;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	struct dir_header h;
+	struct inode *inode;
+	bool success;
+
+	ASSERT (sizeof (struct dir_block) == DISK_SECTOR_SIZE);
+
+	h.magic = DIR_MAGIC;
+	h.entry_cnt = 0;
+	h.block_cnt = DIV_ROUND_UP (entry_cnt, DIR_BLOCK_ENTRIES);
+	h.bucket_cnt = 0;
+	if (!inode_create (sector, (1 + h.block_cnt) * DISK_SECTOR_SIZE,
+				true))
+		return false;
+
+	inode = inode_open (sector);
+	if (inode != NULL)
+		inode_mark_metadata (inode);
+	success = inode != NULL && write_header (inode, &h);
+	inode_close (inode);
+	if (success)
+		dcache_purge (sector);
+	return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -32,6 +134,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_mark_metadata (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -71,32 +174,147 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+/* Searches DIR, whose header is H, for a file with the given NAME.
+ * Only NAME's bucket chain is searched in an indexed directory, and
+ * every block in an unindexed one.
+ * If successful, returns true and sets *EP to the directory entry if
+ * EP is non-null. Either way, fills in *SLOT if it is non-null; the
+ * first free slot seen lets dir_add() skip a second pass. */
 static bool
-lookup (const struct dir *dir, const char *name,
-		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+lookup (const struct dir *dir, const struct dir_header *h, const char *name,
+		struct dir_entry *ep, struct dir_slot *slot) {
+	struct dir_block b;
+	struct dir_slot s;
+	uint32_t block;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
+	s.ofs = s.free_ofs = -1;
+	s.tail = 0;
+	block = h->bucket_cnt > 0 ? bucket_of (h, name) : 1;
+	while (block != 0 && block <= h->block_cnt) {
+		size_t i;
+
+		if (!read_block (dir->inode, block, &b))
+			break;
+		s.tail = block;
+		for (i = 0; i < DIR_BLOCK_ENTRIES; i++) {
+			struct dir_entry *e = &b.entries[i];
+			if (!e->in_use) {
+				if (s.free_ofs == -1)
+					s.free_ofs = entry_ofs (block, i);
+			} else if (!strcmp (name, e->name)) {
+				s.ofs = entry_ofs (block, i);
+				if (ep != NULL)
+					*ep = *e;
+				if (slot != NULL)
+					*slot = s;
+				return true;
+			}
 		}
+		block = h->bucket_cnt > 0 ? b.next : block + 1;
+	}
+	if (slot != NULL)
+		*slot = s;
 	return false;
 }
 
+/* Appends an empty block to DIR, whose header is H, and links it after
+ * block TAIL if TAIL is nonzero. Returns the new block's number, or 0
+ * on failure. */
+static uint32_t
+append_block (struct dir *dir, struct dir_header *h, uint32_t tail) {
+	struct dir_block b;
+	uint32_t block = h->block_cnt + 1;
+
+	memset (&b, 0, sizeof b);
+	if (!write_block (dir->inode, block, &b))
+		return 0;
+	if (tail != 0) {
+		uint32_t next = block;
+		off_t ofs = tail * DISK_SECTOR_SIZE + offsetof (struct dir_block, next);
+		if (inode_write_at (dir->inode, &next, sizeof next, ofs) != sizeof next)
+			return 0;
+	}
+	h->block_cnt = block;
+	return block;
+}
+
+/* Stores E in DIR, whose header is H, without checking for duplicates.
+ * HINT, if non-null, is what lookup() found for E's name under H, so
+ * that the search need not be repeated.
+ * Updates H but does not write it back.
+ * Returns true if successful, false on failure. */
+static bool
+insert (struct dir *dir, struct dir_header *h, const struct dir_entry *e,
+		const struct dir_slot *hint) {
+	struct dir_slot slot;
+	off_t ofs;
+
+	if (hint == NULL) {
+		lookup (dir, h, e->name, NULL, &slot);
+		hint = &slot;
+	}
+	ofs = hint->free_ofs;
+	if (ofs == -1) {
+		uint32_t block = append_block (dir, h,
+				h->bucket_cnt > 0 ? hint->tail : 0);
+		if (block == 0)
+			return false;
+		ofs = entry_ofs (block, 0);
+	}
+	if (inode_write_at (dir->inode, e, sizeof *e, ofs) != sizeof *e)
+		return false;
+	h->entry_cnt++;
+	return true;
+}
+
+/* Rebuilds DIR, whose header is H, as a hash table with BUCKET_CNT
+ * buckets. Updates and writes back H. The rebuild rewrites every block
+ * of the directory, so it runs as one journal operation. The caller
+ * holds DIR's lock, from dir_add().
+ * Returns true if successful, false on failure. */
+static bool
+rehash (struct dir *dir, struct dir_header *h, uint32_t bucket_cnt) {
+	struct dir_entry *entries;
+	struct dir_block b;
+	size_t cnt = 0, i;
+	uint32_t block;
+	bool success = false;
+
+	/* Gather the entries in use. */
+	entries = malloc (h->entry_cnt * sizeof *entries);
+	if (entries == NULL && h->entry_cnt > 0)
+		return false;
+	journal_begin ();
+	for (block = 1; block <= h->block_cnt; block++) {
+		if (!read_block (dir->inode, block, &b))
+			goto done;
+		for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+			if (b.entries[i].in_use && cnt < h->entry_cnt)
+				entries[cnt++] = b.entries[i];
+	}
+
+	/* Lay out empty buckets and reinsert. */
+	memset (&b, 0, sizeof b);
+	for (block = 1; block <= bucket_cnt; block++)
+		if (!write_block (dir->inode, block, &b))
+			goto done;
+	h->entry_cnt = 0;
+	h->block_cnt = bucket_cnt;
+	h->bucket_cnt = bucket_cnt;
+	for (i = 0; i < cnt; i++)
+		if (!insert (dir, h, &entries[i], NULL))
+			goto done;
+	success = write_header (dir->inode, h);
+
+done:
+	journal_end ();
+	free (entries);
+	return success;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
@@ -104,15 +322,33 @@ lookup (const struct dir *dir, const char *name,
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t dir_sector, sector;
+	struct dir_header h;
 	struct dir_entry e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	/* The lock keeps a concurrent dir_add() or dir_remove() from
+	 * changing the directory between the search and caching its result,
+	 * and the entry from being removed before its inode is open. */
+	inode_lock_dir (dir->inode);
+	dir_sector = inode_get_inumber (dir->inode);
+	if (!dcache_lookup (dir_sector, name, &sector)) {
+		if (!read_header (dir->inode, &h))
+			sector = DCACHE_NONE;
+		else {
+			sector = lookup (dir, &h, name, &e, NULL) ? e.inode_sector
+				: DCACHE_NONE;
+			dcache_insert (dir_sector, name, sector);
+		}
+	}
+
+	if (sector != DCACHE_NONE)
+		*inode = inode_open (sector);
 	else
 		*inode = NULL;
+	inode_unlock_dir (dir->inode);
 
 	return *inode != NULL;
 }
@@ -122,11 +358,13 @@ dir_lookup (const struct dir *dir, const char *name,
  * INODE_SECTOR.
  * Returns true if successful, false on failure.
  * Fails if NAME is invalid (i.e. too long) or a disk or memory
- * error occurs. */
+ * error occurs.
+ * Runs inside the caller's journal operation, since it may rehash. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_header h;
+	struct dir_slot slot, *hint = &slot;
 	struct dir_entry e;
-	off_t ofs;
 	bool success = false;
 
 	ASSERT (dir != NULL);
@@ -137,28 +375,39 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	inode_lock_dir (dir->inode);
+	if (!read_header (dir->inode, &h) || lookup (dir, &h, name, NULL, &slot))
 		goto done;
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
-
-	/* Write slot. */
+	memset (&e, 0, sizeof e);
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
-	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+
+	/* Out of room: index a directory that has outgrown linear search, or
+	 * double the buckets of one whose chains are getting long. Either
+	 * way the slot that the lookup found no longer applies. Otherwise
+	 * the entry goes into the free slot the lookup passed over, or a
+	 * block appended after the last one it searched. */
+	if (slot.free_ofs == -1) {
+		if (h.bucket_cnt == 0 && h.block_cnt >= DIR_LINEAR_BLOCKS) {
+			if (!rehash (dir, &h, DIR_MIN_BUCKETS))
+				goto done;
+			hint = NULL;
+		} else if (h.bucket_cnt > 0
+				&& h.entry_cnt >= h.bucket_cnt * DIR_BLOCK_ENTRIES * 3 / 4) {
+			if (!rehash (dir, &h, h.bucket_cnt * 2))
+				goto done;
+			hint = NULL;
+		}
+	}
+
+	success = insert (dir, &h, &e, hint) && write_header (dir->inode, &h);
 
 done:
+	if (success)
+		dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+	inode_unlock_dir (dir->inode);
 	return success;
 }
 
@@ -167,16 +416,18 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_header h;
+	struct dir_slot slot;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
-	off_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	inode_lock_dir (dir->inode);
+	if (!read_header (dir->inode, &h) || !lookup (dir, &h, name, &e, &slot))
 		goto done;
 
 	/* Open inode. */
@@ -186,7 +437,11 @@ dir_remove (struct dir *dir, const char *name) {
 
 	/* Erase directory entry. */
 	e.in_use = false;
-	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+	if (inode_write_at (dir->inode, &e, sizeof e, slot.ofs) != sizeof e)
+		goto done;
+	h.entry_cnt--;
+	dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NONE);
+	if (!write_header (dir->inode, &h))
 		goto done;
 
 	/* Remove inode. */
@@ -194,6 +449,7 @@ dir_remove (struct dir *dir, const char *name) {
 	success = true;
 
 done:
+	inode_unlock_dir (dir->inode);
 	inode_close (inode);
 	return success;
 }
@@ -203,14 +459,35 @@ done:
  * contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
+	struct dir_header h;
 	struct dir_entry e;
+	bool found = false;
 
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+	inode_lock_dir (dir->inode);
+	if (!read_header (dir->inode, &h))
+		goto done;
+	if (dir->pos < DISK_SECTOR_SIZE)
+		dir->pos = DISK_SECTOR_SIZE;
+
+	while (dir->pos < (off_t) (h.block_cnt + 1) * DISK_SECTOR_SIZE) {
+		size_t idx = dir->pos % DISK_SECTOR_SIZE / sizeof e;
+
+		/* Skip the tail of the block. */
+		if (idx >= DIR_BLOCK_ENTRIES) {
+			dir->pos = ROUND_UP (dir->pos, DISK_SECTOR_SIZE);
+			continue;
+		}
+		if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+			break;
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			found = true;
+			break;
 		}
 	}
-	return false;
+
+done:
+	inode_unlock_dir (dir->inode);
+	return found;
 }
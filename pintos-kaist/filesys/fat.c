@@ -1,4 +1,6 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
+#include <round.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -9,7 +11,7 @@
 /* Should be less than DISK_SECTOR_SIZE */
 struct fat_boot {
 	unsigned int magic;
-	unsigned int sectors_per_cluster; /* Fixed to 1 */
+	unsigned int sectors_per_cluster; /* Chosen at format time. */
 	unsigned int total_sectors;
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
@@ -22,20 +24,38 @@ struct fat_fs {
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;         /* Where the next allocation starts. */
+	struct bitmap *free_clst;    /* One bit per cluster, set if in use. */
+	struct bitmap *dirty;        /* One bit per FAT sector, set if modified. */
 	struct lock write_lock;
 };
 
 static struct fat_fs *fat_fs;
 
+/* Sectors per cluster for the next format. */
+static unsigned format_cluster_sectors = SECTORS_PER_CLUSTER;
+
 void fat_boot_create (void);
 void fat_fs_init (void);
 
+/* Sets the cluster size, in sectors, that fat_create() formats the disk
+ * with. SECTORS must be a power of 2 no larger than
+ * MAX_SECTORS_PER_CLUSTER. An existing file system keeps the cluster
+ * size it was formatted with. */
+void
+fat_set_cluster_size (unsigned sectors) {
+	if (sectors == 0 || sectors > MAX_SECTORS_PER_CLUSTER
+			|| (sectors & (sectors - 1)) != 0)
+		PANIC ("bad FAT cluster size %u", sectors);
+	format_cluster_sectors = sectors;
+}
+
 void
 fat_init (void) {
 	fat_fs = calloc (1, sizeof (struct fat_fs));
 	if (fat_fs == NULL)
 		PANIC ("FAT init failed");
+	lock_init (&fat_fs->write_lock);
 
 	// Read boot sector from the disk
 	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
@@ -46,13 +66,16 @@ fat_init (void) {
 	free (bounce);
 
 	// Extract FAT info
-	if (fat_fs->bs.magic != FAT_MAGIC)
+	if (fat_fs->bs.magic != FAT_MAGIC
+			|| fat_fs->bs.sectors_per_cluster == 0
+			|| fat_fs->bs.sectors_per_cluster > MAX_SECTORS_PER_CLUSTER)
 		fat_boot_create ();
 	fat_fs_init ();
 }
 
 void
 fat_open (void) {
+	free (fat_fs->fat);
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
@@ -64,6 +87,8 @@ fat_open (void) {
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
 	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
 		bytes_left = fat_size_in_bytes - bytes_read;
+		if (bytes_left <= 0)
+			break;
 		if (bytes_left >= DISK_SECTOR_SIZE) {
 			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
 			           buffer + bytes_read);
@@ -78,6 +103,11 @@ fat_open (void) {
 			free (bounce);
 		}
 	}
+
+	// Index the free clusters
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		bitmap_set (fat_fs->free_clst, clst, fat_fs->fat[clst] != 0);
+	bitmap_set_all (fat_fs->dirty, false);
 }
 
 void
@@ -90,40 +120,45 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
+	// Write the modified FAT sectors back to the disk
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
 	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
+		off_t ofs = i * DISK_SECTOR_SIZE;
+		off_t bytes_left = fat_size_in_bytes - ofs;
+
+		if (!bitmap_test (fat_fs->dirty, i))
+			continue;
+		if (bytes_left >= DISK_SECTOR_SIZE)
+			disk_write (filesys_disk, fat_fs->bs.fat_start + i, buffer + ofs);
+		else {
 			bounce = calloc (1, DISK_SECTOR_SIZE);
 			if (bounce == NULL)
 				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
+			if (bytes_left > 0)
+				memcpy (bounce, buffer + ofs, bytes_left);
 			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
 			free (bounce);
 		}
+		bitmap_reset (fat_fs->dirty, i);
 	}
 }
 
 void
 fat_create (void) {
-	// Create FAT boot
+	// Create FAT boot, replacing the geometry fat_init() read
 	fat_boot_create ();
 	fat_fs_init ();
 
 	// Create FAT table
+	free (fat_fs->fat);
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
 
+	// The whole table is new, so all of it must be written
+	bitmap_set_all (fat_fs->dirty, true);
+
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
@@ -131,7 +166,9 @@ fat_create (void) {
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	for (unsigned i = 0; i < fat_fs->bs.sectors_per_cluster; i++)
+		disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER) + i,
+		            buf);
 	free (buf);
 }
 
@@ -139,10 +176,11 @@ void
 fat_boot_create (void) {
 	unsigned int fat_sectors =
 	    (disk_size (filesys_disk) - 1)
-	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
+	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * format_cluster_sectors + 1)
+	    + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
-	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
+	    .sectors_per_cluster = format_cluster_sectors,
 	    .total_sectors = disk_size (filesys_disk),
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
@@ -150,44 +188,135 @@ fat_boot_create (void) {
 	};
 }
 
+/* Derives the FAT geometry from the boot sector and creates the free
+ * cluster and dirty sector indexes, replacing any from an earlier call
+ * (fat_create() reformats after fat_init() has already run). */
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	struct fat_boot *bs = &fat_fs->bs;
+	size_t entries = bs->fat_sectors * (DISK_SECTOR_SIZE / sizeof (cluster_t));
+	size_t clusters;
+
+	/* Clusters are numbered from 1, so entry 0 of the FAT is unused.
+	 * There are as many as fit both in the FAT and on the disk. */
+	fat_fs->data_start = bs->fat_start + bs->fat_sectors;
+	clusters = (bs->total_sectors - fat_fs->data_start) / bs->sectors_per_cluster;
+	fat_fs->fat_length = clusters + 1 < entries ? clusters + 1 : entries;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+
+	if (fat_fs->free_clst != NULL)
+		bitmap_destroy (fat_fs->free_clst);
+	if (fat_fs->dirty != NULL)
+		bitmap_destroy (fat_fs->dirty);
+	fat_fs->free_clst = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty = bitmap_create (bs->fat_sectors);
+	if (fat_fs->free_clst == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT init failed");
+	bitmap_mark (fat_fs->free_clst, 0);
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets the FAT entry for CLST to VAL, keeping the free cluster index and
+ * dirty sectors up to date. The write lock must be held. */
+static void
+set_entry (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	fat_fs->fat[clst] = val;
+	bitmap_set (fat_fs->free_clst, clst, val != 0);
+	bitmap_mark (fat_fs->dirty,
+			clst * sizeof (cluster_t) / DISK_SECTOR_SIZE);
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	size_t new;
+
+	lock_acquire (&fat_fs->write_lock);
+
+	/* Next fit: search from just after the last allocation, then wrap. */
+	new = bitmap_scan (fat_fs->free_clst, fat_fs->last_clst, 1, false);
+	if (new == BITMAP_ERROR)
+		new = bitmap_scan (fat_fs->free_clst, 1, 1, false);
+	if (new == BITMAP_ERROR) {
+		lock_release (&fat_fs->write_lock);
+		return 0;
+	}
+
+	set_entry (new, EOChain);
+	if (clst != 0)
+		set_entry (clst, new);
+	fat_fs->last_clst = new + 1 < fat_fs->fat_length ? new + 1 : 1;
+
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		set_entry (clst, 0);
+		clst = next;
+	}
+	if (pclst != 0)
+		set_entry (pclst, EOChain);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	set_entry (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * fat_fs->bs.sectors_per_cluster;
+}
+
+/* Starts POS at the head of the chain beginning with START. */
+void
+fat_pos_init (struct fat_pos *pos, cluster_t start) {
+	pos->start = start;
+	pos->idx = 0;
+	pos->clst = start;
+}
+
+/* Returns the IDX'th cluster (counting from 0) of POS's chain, or 0 if
+ * the chain is shorter than that. Walks forward from the position
+ * remembered in POS when it can, so that sequential access costs one
+ * FAT lookup per cluster rather than a walk from the head of the
+ * chain. */
+cluster_t
+fat_pos_seek (struct fat_pos *pos, size_t idx) {
+	if (pos->clst == 0 || pos->clst == EOChain || idx < pos->idx) {
+		pos->idx = 0;
+		pos->clst = pos->start;
+	}
+	while (pos->idx < idx && pos->clst != 0 && pos->clst != EOChain) {
+		pos->clst = fat_get (pos->clst);
+		pos->idx++;
+	}
+	return pos->clst != EOChain ? pos->clst : 0;
 }
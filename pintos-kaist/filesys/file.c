@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -8,8 +9,17 @@ struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	off_t ra_next;              /* Where a sequential read would start. */
+	off_t ra_end;               /* End of the range already read ahead. */
+	off_t ra_window;            /* Read-ahead window, 0 if not sequential. */
 };
 
+/* Bounds of the read-ahead window, in bytes. */
+#define RA_MIN_WINDOW (4 * DISK_SECTOR_SIZE)
+#define RA_MAX_WINDOW (32 * DISK_SECTOR_SIZE)
+
+static void file_readahead (struct file *, off_t pos, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
@@ -20,6 +30,8 @@ file_open (struct inode *inode) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = file->ra_end = 0;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
@@ -71,7 +83,10 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	off_t bytes_read;
+
+	file_readahead (file, file->pos, size);
+	bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,15 +98,43 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
+	file_readahead (file, file_ofs, size);
 	return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Detects sequential access before a read of SIZE bytes at POS in FILE.
+ * A read that starts where the previous one ended grows the read-ahead
+ * window, from RA_MIN_WINDOW up to RA_MAX_WINDOW, and queues the part of
+ * the window past this read that has not been queued yet. Any other read
+ * closes the window, so random access costs nothing extra. */
+static void
+file_readahead (struct file *file, off_t pos, off_t size) {
+	off_t start, end;
+
+	if (pos != file->ra_next) {
+		file->ra_window = 0;
+		file->ra_next = file->ra_end = pos + size;
+		return;
+	}
+
+	if (file->ra_window == 0)
+		file->ra_window = RA_MIN_WINDOW;
+	else if (file->ra_window < RA_MAX_WINDOW)
+		file->ra_window *= 2;
+
+	start = pos + size > file->ra_end ? pos + size : file->ra_end;
+	end = pos + size + file->ra_window;
+	if (start < end)
+		inode_readahead (file->inode, start, end - start);
+	file->ra_next = pos + size;
+	file->ra_end = end;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past end of file grows the file.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
@@ -103,9 +146,8 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past end of file grows the file.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -2,9 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/fat.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
 
@@ -17,10 +21,12 @@ static void do_format (void);
  * If FORMAT is true, reformats the file system. */
 void
 filesys_init (bool format) {
-	filesys_disk = disk_get (0, 1);
+	filesys_disk = disk_get_role (DISK_FILESYS);
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	cache_init ();
+	dcache_init ();
 	inode_init ();
 
 #ifdef EFILESYS
@@ -32,6 +38,7 @@ filesys_init (bool format) {
 	fat_open ();
 #else
 	/* Original FS */
+	journal_init (format);
 	free_map_init ();
 
 	if (format)
@@ -50,7 +57,9 @@ filesys_done (void) {
 	fat_close ();
 #else
 	free_map_close ();
+	journal_done ();
 #endif
+	cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -60,14 +69,20 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
+			&& free_map_allocate_near (inode_get_inumber (dir_get_inode (dir)),
+				1, &inode_sector)
+			&& inode_create (inode_sector, initial_size, false)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -95,9 +110,14 @@ filesys_open (const char *name) {
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
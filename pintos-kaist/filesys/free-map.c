@@ -1,21 +1,139 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Sectors of the free map file whose bits changed since they were last
+ * written, one bit per sector. Allocation and release only mark them;
+ * free_map_flush() writes them back. */
+static struct bitmap *free_map_dirty;
+
+/* Number of free map bits held by one sector of the free map file. */
+#define SECTOR_BITS (DISK_SECTOR_SIZE * 8)
+
+/* Free space summary: the number of free sectors in each group of
+ * GROUP_SECTORS consecutive sectors, so that searches can skip over
+ * groups that are full. */
+#define GROUP_SECTORS 1024
+static size_t *group_free;
+static size_t group_cnt;
+
+/* Where the next allocation without a placement goal starts looking
+ * (next fit), so that successive allocations do not rescan the full
+ * region at the start of the disk. */
+static disk_sector_t alloc_cursor;
+
+static struct lock free_map_lock;    /* Protects everything above. */
+
+/* Marks the free map file sectors that hold the bits for the CNT
+ * sectors starting at SECTOR as dirty. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt) {
+	size_t first = sector / SECTOR_BITS;
+	size_t last = (sector + cnt - 1) / SECTOR_BITS;
+
+	if (cnt > 0)
+		bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Marks the CNT sectors starting at SECTOR as USED or free, keeping
+ * the group summary and dirty sectors current. */
+static void
+set_range (disk_sector_t sector, size_t cnt, bool used) {
+	size_t end = sector + cnt;
+	size_t s;
+
+	bitmap_set_multiple (free_map, sector, cnt, used);
+	mark_dirty (sector, cnt);
+	for (s = sector; s < end; s = ROUND_DOWN (s, GROUP_SECTORS) + GROUP_SECTORS) {
+		size_t g = s / GROUP_SECTORS;
+		size_t group_end = (g + 1) * GROUP_SECTORS;
+		size_t n = (end < group_end ? end : group_end) - s;
+
+		if (used)
+			group_free[g] -= n;
+		else
+			group_free[g] += n;
+	}
+}
+
+/* Recomputes the group summary from the free map. */
+static void
+count_groups (void) {
+	size_t sector_cnt = bitmap_size (free_map);
+	size_t g;
+
+	for (g = 0; g < group_cnt; g++) {
+		size_t start = g * GROUP_SECTORS;
+		size_t n = sector_cnt - start < GROUP_SECTORS ? sector_cnt - start
+			: GROUP_SECTORS;
+		group_free[g] = n - bitmap_count (free_map, start, n, true);
+	}
+}
+
+/* Returns the first run of CNT free sectors at or after START,
+ * skipping whole groups that have no free sectors, or BITMAP_ERROR if
+ * there is none. */
+static disk_sector_t
+scan_from (disk_sector_t start, size_t cnt) {
+	size_t g;
+
+	for (g = start / GROUP_SECTORS; g < group_cnt && group_free[g] == 0; g++)
+		start = (g + 1) * GROUP_SECTORS;
+	if (start >= bitmap_size (free_map))
+		return BITMAP_ERROR;
+	return bitmap_scan (free_map, start, cnt, false);
+}
+
+/* Allocates CNT sectors as close after GOAL as possible, wrapping
+ * around to the start of the disk, and returns the first one, or
+ * BITMAP_ERROR if there is no run of CNT free sectors.
+ * The caller must hold free_map_lock. */
+static disk_sector_t
+allocate_near (disk_sector_t goal, size_t cnt) {
+	disk_sector_t sector;
+
+	if (goal >= bitmap_size (free_map))
+		goal = 0;
+	sector = scan_from (goal, cnt);
+	if (sector == BITMAP_ERROR && goal > 0)
+		sector = scan_from (0, cnt);
+	if (sector != BITMAP_ERROR)
+		set_range (sector, cnt, true);
+	return sector;
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+				DISK_SECTOR_SIZE));
+	if (free_map_dirty == NULL)
+		PANIC ("bitmap creation failed--disk is too large");
+	group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+	group_free = malloc (group_cnt * sizeof *group_free);
+	if (group_free == NULL)
+		PANIC ("free map summary allocation failed");
+	lock_init (&free_map_lock);
+	alloc_cursor = 0;
+
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +142,82 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	disk_sector_t sector;
+
+	lock_acquire (&free_map_lock);
+	sector = allocate_near (alloc_cursor, cnt);
+	if (sector != BITMAP_ERROR) {
+		alloc_cursor = sector + cnt;
+		*sectorp = sector;
 	}
+	lock_release (&free_map_lock);
+	return sector != BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+ * after GOAL as possible, and stores the first into *SECTORP.
+ * Returns true if successful, false if all sectors were
+ * available. */
+bool
+free_map_allocate_near (disk_sector_t goal, size_t cnt,
+		disk_sector_t *sectorp) {
+	disk_sector_t sector;
+
+	lock_acquire (&free_map_lock);
+	sector = allocate_near (goal, cnt);
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
+	lock_release (&free_map_lock);
 	return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT sectors starting at SECTOR, if all of them are
+ * free.
+ * Returns true if successful, false otherwise. */
+bool
+free_map_allocate_at (disk_sector_t sector, size_t cnt) {
+	bool success = false;
+
+	lock_acquire (&free_map_lock);
+	if (sector + cnt <= bitmap_size (free_map)
+			&& bitmap_none (free_map, sector, cnt)) {
+		set_range (sector, cnt, true);
+		success = true;
+	}
+	lock_release (&free_map_lock);
+	return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	set_range (sector, cnt, false);
+	journal_revoke (sector, cnt);
+	lock_release (&free_map_lock);
+}
+
+/* Writes the dirty sectors of the free map to disk. */
+void
+free_map_flush (void) {
+	size_t bit_cnt;
+	size_t i;
+
+	if (free_map_file == NULL)
+		return;
+	lock_acquire (&free_map_lock);
+	bit_cnt = bitmap_size (free_map);
+	for (i = 0; i < bitmap_size (free_map_dirty); i++)
+		if (bitmap_test (free_map_dirty, i)) {
+			size_t start = i * SECTOR_BITS;
+			size_t cnt = bit_cnt - start < SECTOR_BITS ? bit_cnt - start
+				: SECTOR_BITS;
+			if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+				PANIC ("can't write free map");
+			bitmap_reset (free_map_dirty, i);
+		}
+	lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -50,14 +226,18 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_mark_metadata (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+	count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_flush ();
 	file_close (free_map_file);
+	free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -65,13 +245,42 @@ free_map_close (void) {
 void
 free_map_create (void) {
 	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), true))
 		PANIC ("free map creation failed");
 
 	/* Write bitmap to file. */
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_mark_metadata (file_get_inode (free_map_file));
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	bitmap_set_all (free_map_dirty, false);
+}
+
+/* Prints how fragmented the free space is. */
+void
+free_map_print_stats (void) {
+	size_t sector_cnt, free_cnt = 0, run_cnt = 0, largest = 0;
+	size_t s = 0;
+
+	if (free_map == NULL)
+		return;
+	sector_cnt = bitmap_size (free_map);
+	while (s < sector_cnt) {
+		size_t run;
+
+		s = bitmap_scan (free_map, s, 1, false);
+		if (s == BITMAP_ERROR)
+			break;
+		run = bitmap_scan (free_map, s, 1, true);
+		run = (run == BITMAP_ERROR ? sector_cnt : run) - s;
+		free_cnt += run;
+		run_cnt++;
+		if (run > largest)
+			largest = run;
+		s += run;
+	}
+	printf ("Free map: %zu free sectors in %zu runs, largest %zu\n",
+			free_cnt, run_cnt, largest);
 }
@@ -1,22 +1,56 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of data sectors that are contiguous both in the file and on
+ * disk. */
+struct extent {
+	uint32_t first;                     /* Index of first sector in file. */
+	disk_sector_t start;                /* First sector on disk. */
+	uint32_t cnt;                       /* Number of sectors. */
+};
+
+/* Extents stored in the inode itself, and in its overflow block. */
+#define DIRECT_EXTENTS 41
+#define OVERFLOW_EXTENTS (DISK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (DIRECT_EXTENTS + OVERFLOW_EXTENTS)
+
+/* Largest file whose data fits in the inode sector itself. */
+#define INLINE_BYTES (DIRECT_EXTENTS * sizeof (struct extent))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is stored in the inode. */
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * A file's data is described by EXTENT_CNT extents, sorted by position in
+ * the file. The first DIRECT_EXTENTS live here and the rest in the
+ * OVERFLOW sector.
+ * A regular file of at most INLINE_BYTES instead keeps its data in the
+ * space of the extent table, with INODE_INLINE set and no extents, until
+ * it grows past that. Metadata inodes never do; see inode_create(). */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents in use. */
+	disk_sector_t overflow;             /* Overflow extent block, or 0. */
+	union {
+		struct extent extents[DIRECT_EXTENTS];  /* Leading extents. */
+		uint8_t inline_data[INLINE_BYTES];  /* Data of an inline file. */
+	};
+	uint32_t flags;                     /* INODE_* flags. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,44 +62,305 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	bool meta;                          /* Holds file system metadata? */
+	bool loading;                       /* Disk inode still being read? */
+	struct lock grow_lock;              /* Serializes file growth. */
+	struct lock dir_lock;               /* Serializes directory operations. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Reads extent IDX of DISK_INODE into *E. */
+static void
+get_extent (const struct inode_disk *disk_inode, size_t idx, struct extent *e) {
+	ASSERT (idx < disk_inode->extent_cnt);
+	if (idx < DIRECT_EXTENTS)
+		*e = disk_inode->extents[idx];
+	else
+		cache_read (disk_inode->overflow, e,
+				(idx - DIRECT_EXTENTS) * sizeof *e, sizeof *e);
+}
+
+/* Stores E as extent IDX of DISK_INODE. */
+static void
+set_extent (struct inode_disk *disk_inode, size_t idx, const struct extent *e) {
+	ASSERT (idx < MAX_EXTENTS);
+	if (idx < DIRECT_EXTENTS)
+		disk_inode->extents[idx] = *e;
+	else
+		cache_write_meta (disk_inode->overflow, e,
+				(idx - DIRECT_EXTENTS) * sizeof *e, sizeof *e);
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
+	const struct inode_disk *disk_inode;
+	size_t sector_idx, lo, hi;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	if (pos >= inode->data.length)
 		return -1;
+
+	/* Binary search for the extent that holds the sector. */
+	disk_inode = &inode->data;
+	sector_idx = pos / DISK_SECTOR_SIZE;
+	lo = 0;
+	hi = disk_inode->extent_cnt;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct extent e;
+
+		get_extent (disk_inode, mid, &e);
+		if (sector_idx < e.first)
+			hi = mid;
+		else if (sector_idx >= e.first + e.cnt)
+			lo = mid + 1;
+		else
+			return e.start + (sector_idx - e.first);
+	}
+	return -1;
+}
+
+/* Writes zeros to the CNT sectors starting at SECTOR, newly allocated to
+ * a file. The zeros go through the journal in the same transaction as
+ * the extent that allocates them, so that after a crash the file never
+ * exposes what the sectors held before. File data written over them
+ * later revokes them from the journal; see cache_write(). */
+static void
+zero_sectors (disk_sector_t sector, size_t cnt) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	for (; cnt > 0; cnt--)
+		cache_write_meta (sector++, zeros, 0, DISK_SECTOR_SIZE);
+}
+
+/* Extra sectors reserved past the end of a file each time a write
+ * grows it, so that a sequential writer keeps extending one extent even
+ * when other files are growing at the same time. The reservation is
+ * trimmed off when the file is last closed. */
+#define PREALLOC_SECTORS 8
+
+/* Returns the number of data sectors allocated to DISK_INODE. */
+static size_t
+inode_allocated (const struct inode_disk *disk_inode) {
+	struct extent last;
+
+	if (disk_inode->extent_cnt == 0)
+		return 0;
+	get_extent (disk_inode, disk_inode->extent_cnt - 1, &last);
+	return last.first + last.cnt;
+}
+
+/* Allocates zeroed data sectors for DISK_INODE, whose own sector is
+ * SECTOR, until it holds at least SECTORS of them. Grows the last extent
+ * in place while the sectors that follow it are free, so appends stay
+ * contiguous, and otherwise starts a new extent as large as the free
+ * space allows, as close after the file's existing data (or its inode)
+ * as possible.
+ * Returns false if the disk or the extent table fills up; sectors
+ * allocated before that stay recorded in DISK_INODE. */
+static bool
+inode_extend (struct inode_disk *disk_inode, disk_sector_t sector,
+		size_t sectors) {
+	size_t allocated = inode_allocated (disk_inode);
+	disk_sector_t goal = sector + 1;
+	struct extent last;
+
+	if (disk_inode->extent_cnt > 0) {
+		get_extent (disk_inode, disk_inode->extent_cnt - 1, &last);
+		goal = last.start + last.cnt;
+	}
+
+	while (allocated < sectors) {
+		size_t cnt = sectors - allocated;
+		disk_sector_t start;
+
+		/* Try to extend the last extent. */
+		if (disk_inode->extent_cnt > 0) {
+			while (cnt > 0
+					&& !free_map_allocate_at (last.start + last.cnt, cnt))
+				cnt /= 2;
+			if (cnt > 0) {
+				zero_sectors (last.start + last.cnt, cnt);
+				last.cnt += cnt;
+				set_extent (disk_inode, disk_inode->extent_cnt - 1, &last);
+				allocated += cnt;
+				continue;
+			}
+			cnt = sectors - allocated;
+		}
+
+		/* Start a new extent. */
+		if (disk_inode->extent_cnt == MAX_EXTENTS)
+			return false;
+		if (disk_inode->extent_cnt == DIRECT_EXTENTS
+				&& disk_inode->overflow == 0) {
+			if (!free_map_allocate_near (sector, 1, &disk_inode->overflow))
+				return false;
+			zero_sectors (disk_inode->overflow, 1);
+		}
+		while (cnt > 0 && !free_map_allocate_near (goal, cnt, &start))
+			cnt /= 2;
+		if (cnt == 0)
+			return false;
+		zero_sectors (start, cnt);
+
+		last.first = allocated;
+		last.start = start;
+		last.cnt = cnt;
+		set_extent (disk_inode, disk_inode->extent_cnt++, &last);
+		allocated += cnt;
+		goal = start + cnt;
+	}
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Releases the data sectors of DISK_INODE beyond the first SECTORS, and
+ * its overflow block once the extents fit in the inode again.
+ * Returns true if any were released. */
+static bool
+inode_trim (struct inode_disk *disk_inode, size_t sectors) {
+	bool trimmed = false;
+
+	while (disk_inode->extent_cnt > 0) {
+		struct extent last;
+		size_t keep;
+
+		get_extent (disk_inode, disk_inode->extent_cnt - 1, &last);
+		keep = sectors > last.first ? sectors - last.first : 0;
+		if (keep >= last.cnt)
+			break;
+		free_map_release (last.start + keep, last.cnt - keep);
+		trimmed = true;
+		if (keep > 0) {
+			last.cnt = keep;
+			set_extent (disk_inode, disk_inode->extent_cnt - 1, &last);
+			break;
+		}
+		disk_inode->extent_cnt--;
+	}
+	if (disk_inode->extent_cnt <= DIRECT_EXTENTS
+			&& disk_inode->overflow != 0) {
+		free_map_release (disk_inode->overflow, 1);
+		disk_inode->overflow = 0;
+		trimmed = true;
+	}
+	return trimmed;
+}
+
+/* Releases all of DISK_INODE's data sectors and its overflow block. */
+static void
+inode_release (struct inode_disk *disk_inode) {
+	size_t i;
+
+	for (i = 0; i < disk_inode->extent_cnt; i++) {
+		struct extent e;
+		get_extent (disk_inode, i, &e);
+		free_map_release (e.start, e.cnt);
+	}
+	if (disk_inode->overflow != 0)
+		free_map_release (disk_inode->overflow, 1);
+	disk_inode->extent_cnt = 0;
+	disk_inode->overflow = 0;
+}
+
+/* Moves the inline data of INODE out to data sectors, allocating at
+ * least SECTORS of them. Must be called with INODE's grow_lock held.
+ * Returns false, leaving INODE inline, if allocation fails. */
+static bool
+inode_spill (struct inode *inode, size_t sectors) {
+	struct inode_disk *disk_inode;
+	struct extent first;
+	bool success = false;
+
+	ASSERT (inode->data.flags & INODE_INLINE);
+	ASSERT (sectors > 0);
+
+	/* Build the extent table in a copy, so that INODE stays intact for
+	 * readers and for a retry if the disk is full. */
+	disk_inode = malloc (sizeof *disk_inode);
+	if (disk_inode == NULL)
+		return false;
+	memcpy (disk_inode, &inode->data, sizeof *disk_inode);
+	memset (disk_inode->extents, 0, sizeof disk_inode->extents);
+	disk_inode->extent_cnt = 0;
+	disk_inode->overflow = 0;
+
+	if (inode_extend (disk_inode, inode->sector, sectors)) {
+		/* The data moves from the inode, which is journaled, to a data
+		 * sector. Write it through the journal too, so that it commits
+		 * with the extent table that points at it; otherwise a crash
+		 * could leave the committed inode naming a sector whose data
+		 * never reached the disk. */
+		get_extent (disk_inode, 0, &first);
+		cache_write_meta (first.start, inode->data.inline_data, 0,
+				inode->data.length);
+
+		/* Clear the flag last, so that a reader that sees it clear also
+		 * sees the extent table. */
+		memcpy (&inode->data, disk_inode, sizeof *disk_inode);
+		barrier ();
+		inode->data.flags &= ~INODE_INLINE;
+		success = true;
+	} else
+		inode_release (disk_inode);
+	free (disk_inode);
+	return success;
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode twice
  * returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loading of every open
+ * inode. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an inode in open_inodes finishes loading. */
+static struct condition inode_loaded;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct inode *a = hash_entry (a_, struct inode, elem);
+	const struct inode *b = hash_entry (b_, struct inode, elem);
+	return a->sector < b->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	lock_init (&open_inodes_lock);
+	cond_init (&inode_loaded);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
  * disk.
+ * META is true for an inode that will hold file system metadata, the
+ * free map or a directory, which always gets data sectors even when it
+ * is small enough to be inline. Writing inline data opens a journal
+ * operation, which the free map cannot do: it is written while a commit
+ * is under way, and would wait for that commit forever.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
+inode_create (disk_sector_t sector, off_t length, bool meta) {
 	struct inode_disk *disk_inode = NULL;
 	bool success = false;
 
@@ -77,20 +372,18 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+		if (!meta && length <= (off_t) INLINE_BYTES) {
+			disk_inode->flags = INODE_INLINE;
+			cache_write_meta (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+			success = true;
+		} else if (inode_extend (disk_inode, sector,
+					bytes_to_sectors (length))) {
+			cache_write_meta (sector, disk_inode, 0, DISK_SECTOR_SIZE);
 			success = true; 
-		} 
+		} else
+			inode_release (disk_inode);
 		free (disk_inode);
 	}
 	return success;
@@ -101,42 +394,87 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
-
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
+	struct hash_elem *e;
+	struct inode key, *inode;
+
+	lock_acquire (&open_inodes_lock);
+
+	/* Check whether this inode is already open. If another opener is
+	 * still reading it, wait until it has. */
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		inode->open_cnt++;
+		while (inode->loading)
+			cond_wait (&inode_loaded, &open_inodes_lock);
+		lock_release (&open_inodes_lock);
+		return inode;
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize, then make the inode visible as loading, so that a
+	 * concurrent opener of the same sector waits for it instead of
+	 * reading it again. The disk inode is read without the lock. */
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->meta = false;
+	inode->loading = true;
+	lock_init (&inode->grow_lock);
+	lock_init (&inode->dir_lock);
+	hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+
+	lock_acquire (&open_inodes_lock);
+	inode->loading = false;
+	cond_broadcast (&inode_loaded, &open_inodes_lock);
+	lock_release (&open_inodes_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
+/* Marks INODE as holding file system metadata, such as a directory
+ * or the free map, so that its data is written through the journal. */
+void
+inode_mark_metadata (struct inode *inode) {
+	inode->meta = true;
+}
+
+/* Acquires INODE's directory lock, which the directory code holds across
+ * each lookup, insertion and removal, so that they see and leave the
+ * directory, and the dentry cache entries for it, in a consistent state.
+ * Shared by every opener of the directory. */
+void
+inode_lock_dir (struct inode *inode) {
+	lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode) {
+	lock_release (&inode->dir_lock);
+}
+
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
@@ -152,20 +490,33 @@ inode_close (struct inode *inode) {
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
-
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
-
-		free (inode); 
+	/* Release resources if this was the last opener. Releasing blocks and
+	 * trimming the tail change metadata, so they form one journal
+	 * operation, which has to begin before the lock is taken: it may wait
+	 * for a commit, which may wait for an operation that wants the lock. */
+	journal_begin ();
+	lock_acquire (&open_inodes_lock);
+	if (--inode->open_cnt > 0) {
+		lock_release (&open_inodes_lock);
+		journal_end ();
+		return;
 	}
+
+	/* Deallocate blocks if removed, or give back the preallocated tail
+	 * otherwise. This happens before the inode leaves open_inodes, and
+	 * under the lock, so that reopening it cannot read the disk inode
+	 * before it is written back. */
+	if (inode->removed) {
+		free_map_release (inode->sector, 1);
+		inode_release (&inode->data);
+	} else if (inode_trim (&inode->data,
+				bytes_to_sectors (inode->data.length)))
+		cache_write_meta (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	hash_delete (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+	journal_end ();
+
+	free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -183,7 +534,24 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
+
+	/* A small file is copied straight out of the in-memory inode. Once
+	 * a file leaves the inode it never returns, so only inline files need
+	 * the lock. */
+	if (inode->data.flags & INODE_INLINE) {
+		lock_acquire (&inode->grow_lock);
+		if (inode->data.flags & INODE_INLINE) {
+			if (offset < inode->data.length) {
+				bytes_read = inode->data.length - offset;
+				if (bytes_read > size)
+					bytes_read = size;
+				memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+			}
+			lock_release (&inode->grow_lock);
+			return bytes_read;
+		}
+		lock_release (&inode->grow_lock);
+	}
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
@@ -200,46 +568,94 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		/* Copy the chunk out of the buffer cache. */
+		cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * A write past end of file extends the inode, zero-filling any gap.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
+	/* Grow the file to cover the write. */
+	if (offset + size > inode_length (inode)) {
+		journal_begin ();
+		lock_acquire (&inode->grow_lock);
+		if (offset + size > inode->data.length) {
+			size_t sectors = bytes_to_sectors (offset + size);
+			bool fits = offset + size <= (off_t) INLINE_BYTES;
+
+			if ((inode->data.flags & INODE_INLINE) && !fits)
+				inode_spill (inode, sectors + PREALLOC_SECTORS);
+			if (inode->data.flags & INODE_INLINE) {
+				if (fits) {
+					inode->data.length = offset + size;
+					cache_write_meta (inode->sector, &inode->data, 0,
+							DISK_SECTOR_SIZE);
+				}
+			} else {
+				size_t allocated = inode_allocated (&inode->data);
+
+				if (allocated < sectors)
+					inode_extend (&inode->data, inode->sector,
+							sectors + PREALLOC_SECTORS);
+				if (inode_allocated (&inode->data) >= sectors) {
+					inode->data.length = offset + size;
+					cache_write_meta (inode->sector, &inode->data, 0,
+							DISK_SECTOR_SIZE);
+				} else {
+					/* Not enough room for the write. Give back what
+					 * inode_extend() did get, which was never recorded
+					 * on disk, so it does not leak. */
+					inode_trim (&inode->data, allocated);
+				}
+			}
+		}
+		lock_release (&inode->grow_lock);
+		journal_end ();
+	}
+
+	/* A small file is written in place in its inode sector, which goes
+	 * through the journal like the rest of the inode. */
+	if (inode->data.flags & INODE_INLINE) {
+		bool done = false;
+
+		journal_begin ();
+		lock_acquire (&inode->grow_lock);
+		if (inode->data.flags & INODE_INLINE) {
+			if (offset < inode->data.length) {
+				bytes_written = inode->data.length - offset;
+				if (bytes_written > size)
+					bytes_written = size;
+				memcpy (inode->data.inline_data + offset, buffer, bytes_written);
+				cache_write_meta (inode->sector, buffer,
+						offsetof (struct inode_disk, inline_data) + offset,
+						bytes_written);
+			}
+			done = true;
+		}
+		lock_release (&inode->grow_lock);
+		journal_end ();
+		if (done)
+			return bytes_written;
+	}
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -255,38 +671,40 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* Copy the chunk into the buffer cache, which reads in the
+		   rest of the sector first if the chunk does not cover it. */
+		if (inode->meta)
+			cache_write_meta (sector_idx, buffer + bytes_written, sector_ofs,
+					chunk_size);
+		else
+			cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+					chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_written;
 }
 
+/* Queues the sectors holding the LENGTH bytes at OFFSET in INODE for
+ * read-ahead. The part of the range past end of file is ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t length) {
+	off_t end = offset + length;
+
+	/* An inline file's data is already in memory. */
+	if (inode->data.flags & INODE_INLINE)
+		return;
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE);
+	for (; offset < end; offset += DISK_SECTOR_SIZE)
+		cache_readahead (byte_to_sector (inode, offset));
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
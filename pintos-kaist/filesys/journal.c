@@ -0,0 +1,478 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+ *
+ * Inode, directory and free map sectors are written to the buffer cache
+ * with cache_write_meta(). The cache never writes such a sector home by
+ * itself: when it is evicted, or when a transaction commits, its
+ * contents are handed to journal_log() and kept in the running
+ * transaction. Commit writes the transaction to the journal region as
+ * one or more descriptors, each followed by the sectors it lists, then a
+ * single commit record, and only then writes the sectors to their home
+ * locations. A sector modified by many operations between commits is
+ * therefore written home only once.
+ *
+ * The journal thread commits every COMMIT_INTERVAL ticks, at a moment
+ * when no operation is between journal_begin() and journal_end(), so a
+ * transaction holds whole operations. Once a commit is pending, new
+ * operations wait for it instead of holding it off indefinitely. An
+ * operation that starts while the transaction already holds TX_LIMIT
+ * sectors commits it first, so that it stays small enough for the log.
+ * After a crash, journal_init() redoes any transaction that was
+ * committed but possibly not yet written home.
+ *
+ * A commit moves the running transaction aside and starts a new one
+ * before it drops the journal lock to write the log and the home
+ * locations, so that the buffer cache can go on logging and reading
+ * metadata meanwhile. Until the commit is done, journal_read() finds
+ * sectors in the committing transaction too.
+ *
+ * The region is circular: transactions are appended after one another
+ * and wrap around to the start. The superblock records where the next
+ * transaction goes, and is advanced once a transaction is home. */
+
+/* How often the running transaction commits, in timer ticks. */
+#define COMMIT_INTERVAL TIMER_FREQ
+
+/* Sector numbers within the journal region. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Magic numbers. */
+#define SUPER_MAGIC 0x4a524e4c
+#define DESC_MAGIC 0x4a444553
+#define COMMIT_MAGIC 0x4a434d54
+
+/* Most sectors recorded by one descriptor. */
+#define DESC_SECTORS 125
+
+/* Size of the running transaction, in sectors, at which the next
+ * operation commits it early. Leaves room in the log for the metadata
+ * that the buffer cache still holds dirty. */
+#define TX_LIMIT ((LOG_SECTORS - CACHE_SIZE) / 2)
+
+/* Journal superblock, in JOURNAL_SECTOR. */
+struct journal_super {
+	unsigned magic;                     /* SUPER_MAGIC. */
+	uint32_t head;                      /* Log offset of next transaction. */
+	uint32_t seq;                       /* Sequence number of next one. */
+	uint8_t unused[DISK_SECTOR_SIZE - 12];
+};
+
+/* Transaction descriptor, followed in the log by CNT sector images and
+ * then either another descriptor of the same transaction or its commit
+ * record. A commit record has the same layout, with CNT the total
+ * number of sectors in the transaction. */
+struct journal_desc {
+	unsigned magic;                     /* DESC_MAGIC or COMMIT_MAGIC. */
+	uint32_t seq;                       /* Transaction sequence number. */
+	uint32_t cnt;                       /* Number of sectors logged. */
+	disk_sector_t sectors[DESC_SECTORS];    /* Home of each image. */
+};
+
+/* A sector image held by the running transaction. */
+struct journal_block {
+	struct hash_elem elem;              /* Element in a transaction. */
+	disk_sector_t sector;               /* Home sector. */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Contents. */
+};
+
+static bool enabled;                    /* Journal in use? */
+static struct journal_super super;      /* In-memory superblock. */
+static struct hash tx_tables[2];        /* Storage for the two below. */
+static struct hash *tx_blocks;          /* Running transaction. */
+static struct hash *commit_blocks;      /* Committing transaction, or
+                                           NULL. */
+static int handle_cnt;                  /* Operations in progress. */
+static bool commit_pending;             /* Commit requested or under way? */
+static struct condition quiet;          /* Signaled when handle_cnt drops
+                                           to 0 or a commit finishes. */
+static struct lock journal_lock;        /* Protects everything above. */
+
+/* Statistics. */
+static long long commit_cnt;            /* # of transactions committed. */
+static long long logged_cnt;            /* # of sector images logged. */
+
+static uint64_t block_hash (const struct hash_elem *, void *);
+static bool block_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static struct journal_block *block_lookup (struct hash *, disk_sector_t);
+static void block_free (struct hash_elem *, void *);
+static void write_super (void);
+static void replay (void);
+static void journald (void *aux);
+
+/* Initializes the journal. If FORMAT is true, creates an empty journal;
+ * otherwise recovers from the one on disk. Must run before anything
+ * else reads the file system through the buffer cache. */
+void
+journal_init (bool format) {
+	hash_init (&tx_tables[0], block_hash, block_less, NULL);
+	hash_init (&tx_tables[1], block_hash, block_less, NULL);
+	tx_blocks = &tx_tables[0];
+	commit_blocks = NULL;
+	lock_init (&journal_lock);
+	cond_init (&quiet);
+	handle_cnt = 0;
+	commit_pending = false;
+
+	if (format) {
+		static const uint8_t zeros[DISK_SECTOR_SIZE];
+		static const void *log[LOG_SECTORS];
+		size_t i;
+
+		/* Clear out whatever log an earlier file system left, so that
+		 * none of it can pass for a transaction of this one. */
+		for (i = 0; i < LOG_SECTORS; i++)
+			log[i] = zeros;
+		disk_write_multi (filesys_disk, LOG_START, LOG_SECTORS, log);
+
+		super.magic = SUPER_MAGIC;
+		super.head = 0;
+		super.seq = 1;
+		write_super ();
+	} else {
+		disk_read (filesys_disk, JOURNAL_SECTOR, &super);
+		if (super.magic != SUPER_MAGIC || super.head >= LOG_SECTORS)
+			PANIC ("journal superblock is corrupt");
+		replay ();
+	}
+
+	enabled = true;
+	thread_create ("journald", PRI_DEFAULT, journald, NULL);
+}
+
+/* Returns true if metadata writes go through the journal. */
+bool
+journal_active (void) {
+	return enabled;
+}
+
+/* Starts an operation whose metadata updates must commit together.
+ * Operations may nest; only the outermost one waits for a pending
+ * commit, since the commit in turn waits for it to end. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+	bool full;
+
+	if (!enabled)
+		return;
+	lock_acquire (&journal_lock);
+	full = t->journal_depth == 0 && hash_size (tx_blocks) >= TX_LIMIT;
+	lock_release (&journal_lock);
+	if (full)
+		journal_commit ();
+
+	lock_acquire (&journal_lock);
+	if (t->journal_depth == 0)
+		while (commit_pending)
+			cond_wait (&quiet, &journal_lock);
+	t->journal_depth++;
+	handle_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin(). */
+void
+journal_end (void) {
+	if (!enabled)
+		return;
+	lock_acquire (&journal_lock);
+	ASSERT (handle_cnt > 0);
+	ASSERT (thread_current ()->journal_depth > 0);
+	thread_current ()->journal_depth--;
+	if (--handle_cnt == 0)
+		cond_broadcast (&quiet, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Records DATA as the new contents of metadata SECTOR in the running
+ * transaction. Called by the buffer cache, possibly with its lock
+ * held. */
+void
+journal_log (disk_sector_t sector, const void *data) {
+	struct journal_block *b;
+
+	lock_acquire (&journal_lock);
+	b = block_lookup (tx_blocks, sector);
+	if (b == NULL) {
+		b = malloc (sizeof *b);
+		if (b == NULL) {
+			/* Out of memory: fall back to writing in place. */
+			lock_release (&journal_lock);
+			disk_write (filesys_disk, sector, data);
+			return;
+		}
+		b->sector = sector;
+		hash_insert (tx_blocks, &b->elem);
+		logged_cnt++;
+	}
+	memcpy (b->data, data, DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+}
+
+/* If the running or the committing transaction holds SECTOR, copies it
+ * into DATA and returns true, because it is newer than the copy on
+ * disk. */
+bool
+journal_read (disk_sector_t sector, void *data) {
+	struct journal_block *b;
+
+	if (!enabled)
+		return false;
+	lock_acquire (&journal_lock);
+	b = block_lookup (tx_blocks, sector);
+	if (b == NULL && commit_blocks != NULL)
+		b = block_lookup (commit_blocks, sector);
+	if (b != NULL)
+		memcpy (data, b->data, DISK_SECTOR_SIZE);
+	lock_release (&journal_lock);
+	return b != NULL;
+}
+
+/* Drops CNT sectors starting at SECTOR from the running transaction,
+ * because they were freed or now hold file data. If the committing
+ * transaction holds one of them, waits for it to be written home, so
+ * that its image cannot land on top of what the caller writes next. */
+void
+journal_revoke (disk_sector_t sector, size_t cnt) {
+	size_t i;
+
+	if (!enabled)
+		return;
+	lock_acquire (&journal_lock);
+	for (i = 0; i < cnt; i++) {
+		struct journal_block *b;
+
+		if (!hash_empty (tx_blocks)
+				&& (b = block_lookup (tx_blocks, sector + i)) != NULL) {
+			hash_delete (tx_blocks, &b->elem);
+			free (b);
+		}
+		while (commit_blocks != NULL
+				&& block_lookup (commit_blocks, sector + i) != NULL)
+			cond_wait (&quiet, &journal_lock);
+	}
+	lock_release (&journal_lock);
+}
+
+/* Writes the running transaction to the log, a descriptor and up to
+ * DESC_SECTORS images at a time, followed by one commit record for all
+ * of it. Then writes the images home and frees them. A transaction too
+ * large for the log, which TX_LIMIT makes unlikely, is written home
+ * directly instead, without the protection of the log.
+ * The journal lock must be held. It is dropped for the I/O, with the
+ * transaction moved to commit_blocks and a new one running. */
+static void
+commit_tx (void) {
+	static struct journal_desc desc;
+	struct hash_iterator i;
+	struct hash *tx = tx_blocks;
+	size_t cnt = hash_size (tx);
+	size_t len = cnt + DIV_ROUND_UP (cnt, DESC_SECTORS) + 1;
+	uint32_t pos;
+	bool more;
+
+	if (cnt == 0)
+		return;
+	commit_blocks = tx;
+	tx_blocks = tx == &tx_tables[0] ? &tx_tables[1] : &tx_tables[0];
+	lock_release (&journal_lock);
+
+	if (len > LOG_SECTORS)
+		goto checkpoint;
+
+	/* Transactions never wrap; start over at the top of the log if this
+	 * one does not fit. The superblock must point there first, so that
+	 * recovery finds it. */
+	if (super.head + len > LOG_SECTORS) {
+		super.head = 0;
+		write_super ();
+	}
+
+	/* Log the images under their descriptors, then commit. */
+	pos = super.head;
+	hash_first (&i, tx);
+	more = hash_next (&i);
+	while (more) {
+		memset (&desc, 0, sizeof desc);
+		desc.magic = DESC_MAGIC;
+		desc.seq = super.seq;
+		for (; more && desc.cnt < DESC_SECTORS; more = hash_next (&i)) {
+			struct journal_block *b = hash_entry (hash_cur (&i),
+					struct journal_block, elem);
+			desc.sectors[desc.cnt++] = b->sector;
+			disk_write (filesys_disk, LOG_START + pos + desc.cnt, b->data);
+		}
+		disk_write (filesys_disk, LOG_START + pos, &desc);
+		pos += 1 + desc.cnt;
+	}
+	memset (&desc, 0, sizeof desc);
+	desc.magic = COMMIT_MAGIC;
+	desc.seq = super.seq;
+	desc.cnt = cnt;
+	disk_write (filesys_disk, LOG_START + pos, &desc);
+	super.head = pos + 1;
+	super.seq++;
+	commit_cnt++;
+
+checkpoint:
+	/* Write home and retire the transaction. */
+	hash_first (&i, tx);
+	while (hash_next (&i)) {
+		struct journal_block *b = hash_entry (hash_cur (&i),
+				struct journal_block, elem);
+		disk_write (filesys_disk, b->sector, b->data);
+	}
+	write_super ();
+
+	lock_acquire (&journal_lock);
+	hash_clear (tx, block_free);
+	commit_blocks = NULL;
+}
+
+/* Commits the running transaction: marks a commit pending, so that no
+ * new operation starts, waits until those in progress end, collects the
+ * dirty metadata from the free map and the buffer cache, and writes it
+ * through the log. */
+void
+journal_commit (void) {
+	if (!enabled)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (commit_pending)
+		cond_wait (&quiet, &journal_lock);
+	commit_pending = true;
+	while (handle_cnt > 0)
+		cond_wait (&quiet, &journal_lock);
+	lock_release (&journal_lock);
+
+	free_map_flush ();
+	cache_flush_meta ();
+
+	lock_acquire (&journal_lock);
+	commit_tx ();
+	commit_pending = false;
+	cond_broadcast (&quiet, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Commits everything and stops journaling. */
+void
+journal_done (void) {
+	journal_commit ();
+	enabled = false;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	printf ("Journal: %lld transactions, %lld sectors logged\n",
+			commit_cnt, logged_cnt);
+}
+
+/* Redoes the transaction at the head of the log, if it committed. */
+static void
+replay (void) {
+	static struct journal_desc desc;
+	static uint8_t data[DISK_SECTOR_SIZE];
+	uint32_t pos = super.head;
+	size_t cnt = 0, j;
+
+	/* Walk the transaction's descriptors to its commit record. */
+	for (;;) {
+		if (pos >= LOG_SECTORS)
+			return;
+		disk_read (filesys_disk, LOG_START + pos, &desc);
+		if (desc.seq != super.seq)
+			return;
+		if (desc.magic == COMMIT_MAGIC)
+			break;
+		if (desc.magic != DESC_MAGIC || desc.cnt > DESC_SECTORS)
+			return;
+		cnt += desc.cnt;
+		pos += 1 + desc.cnt;
+	}
+	if (desc.cnt != cnt)
+		return;
+
+	/* Committed: write every image home. */
+	pos = super.head;
+	for (;;) {
+		disk_read (filesys_disk, LOG_START + pos, &desc);
+		if (desc.magic != DESC_MAGIC)
+			break;
+		for (j = 0; j < desc.cnt; j++) {
+			disk_read (filesys_disk, LOG_START + pos + 1 + j, data);
+			disk_write (filesys_disk, desc.sectors[j], data);
+		}
+		pos += 1 + desc.cnt;
+	}
+	printf ("journal: recovered transaction %u (%zu sectors)\n",
+			super.seq, cnt);
+	super.head = pos + 1;
+	super.seq++;
+	write_super ();
+}
+
+/* Writes the superblock to disk. */
+static void
+write_super (void) {
+	disk_write (filesys_disk, JOURNAL_SECTOR, &super);
+}
+
+/* Journal thread. Commits the running transaction periodically, which
+ * is what batches many operations into one commit. */
+static void
+journald (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (COMMIT_INTERVAL);
+		journal_commit ();
+	}
+}
+
+/* Returns the image of SECTOR in transaction TX, or a null pointer.
+ * The journal lock must be held. */
+static struct journal_block *
+block_lookup (struct hash *tx, disk_sector_t sector) {
+	struct journal_block key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find (tx, &key.elem);
+	return e != NULL ? hash_entry (e, struct journal_block, elem) : NULL;
+}
+
+/* Frees journal block E. */
+static void
+block_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct journal_block, elem));
+}
+
+static uint64_t
+block_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct journal_block *b = hash_entry (e, struct journal_block, elem);
+	return hash_int (b->sector);
+}
+
+static bool
+block_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct journal_block *a = hash_entry (a_, struct journal_block, elem);
+	const struct journal_block *b = hash_entry (b_, struct journal_block, elem);
+	return a->sector < b->sector;
+}
@@ -2,11 +2,17 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
 
+/* Most sectors moved by one READ/WRITE command. */
+#define DISK_MAX_MULTI 256
+
 /* Index of a disk sector within a disk.
  * Good enough for disks up to 2 TB. */
 typedef uint32_t disk_sector_t;
@@ -15,13 +21,71 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+struct disk_request;
+
+/* Called, with interrupts off and usually from a disk interrupt
+   handler, when a request has completed.  Must not sleep. */
+typedef void disk_done_func (struct disk_request *, void *aux);
+
+/* An asynchronous request to move CNT consecutive sectors
+   starting at SEC_NO between DISK and BUFFERS, where sector
+   SEC_NO + I uses BUFFERS[I].  The submitter fills in the public
+   members and must keep the request and the buffers alive until
+   DONE is called.  A request for a partition is passed on to the
+   disk holding it with DISK and SEC_NO rewritten. */
+struct disk_request {
+	struct disk *disk;          /* Disk to access. */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	void **buffers;             /* One DISK_SECTOR_SIZE buffer per sector. */
+	bool write;                 /* Write to the disk instead of reading? */
+	disk_done_func *done;       /* Completion callback. */
+	void *aux;                  /* Passed to DONE. */
+
+	/* Owned by the disk driver. */
+	struct list_elem elem;      /* Element in channel's queue. */
+	size_t pos;                 /* Sectors completed so far. */
+	int64_t deadline;           /* Timer tick by which to start it. */
+};
+
+/* Operations of a block device driver. */
+struct disk_ops {
+	const char *type;           /* Kind of device, e.g. "ata". */
+
+	/* Starts request R, whose members have been checked, on the
+	   driver's device AUX, as passed to disk_register().  The
+	   driver completes R by calling R->done with interrupts off. */
+	void (*submit) (struct disk_request *r, void *aux);
+};
+
+/* What the kernel uses a disk for. */
+enum disk_role {
+	DISK_FILESYS,               /* File system. */
+	DISK_SCRATCH,               /* Scratch, for moving files in and out. */
+	DISK_SWAP,                  /* Swap. */
+	DISK_ROLE_CNT
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
+struct disk *disk_register (const char *name, disk_sector_t capacity,
+		const struct disk_ops *, void *aux);
+void disk_set_position (int chan_no, int dev_no, struct disk *);
+bool disk_set_role (enum disk_role, const char *name);
+
 struct disk *disk_get (int chan_no, int dev_no);
+struct disk *disk_get_by_name (const char *name);
+struct disk *disk_get_role (enum disk_role);
+const char *disk_name (struct disk *);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multi (struct disk *, disk_sector_t, size_t cnt,
+		void *buffers[]);
+void disk_write_multi (struct disk *, disk_sector_t, size_t cnt,
+		const void *buffers[]);
+void disk_submit (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -0,0 +1,8 @@
+#ifndef DEVICES_PARTITION_H
+#define DEVICES_PARTITION_H
+
+struct disk;
+
+void partition_scan (struct disk *);
+
+#endif /* devices/partition.h */
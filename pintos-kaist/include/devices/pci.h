@@ -0,0 +1,40 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function, identified by its position on the bus. */
+struct pci_device {
+	uint8_t bus;                /* Bus number. */
+	uint8_t dev;                /* Device number on the bus. */
+	uint8_t func;               /* Function number within the device. */
+	uint8_t class;              /* Class code. */
+	uint8_t subclass;           /* Subclass code. */
+	uint8_t prog_if;            /* Programming interface. */
+	uint16_t vendor_id;         /* Vendor ID. */
+	uint16_t device_id;         /* Device ID. */
+};
+
+/* Configuration space registers. */
+#define PCI_REG_ID 0x00         /* Device ID and vendor ID. */
+#define PCI_REG_COMMAND 0x04    /* Status and command. */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog IF, revision. */
+#define PCI_REG_HEADER 0x0c     /* BIST, header type, latency, line size. */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N))     /* Base address register N. */
+#define PCI_REG_INTR 0x3c       /* Max latency, min grant, pin, line. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Bus master enable. */
+
+/* Called by pci_scan() for each function found.  Returns false
+   to stop the scan. */
+typedef bool pci_scan_func (const struct pci_device *, void *aux);
+
+uint32_t pci_read_config (const struct pci_device *, uint8_t reg);
+void pci_write_config (const struct pci_device *, uint8_t reg, uint32_t);
+void pci_scan (pci_scan_func *, void *aux);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,11 @@
+#ifndef DEVICES_RAID0_H
+#define DEVICES_RAID0_H
+
+#include <stdbool.h>
+
+bool raid0_configure (const char *list);
+bool raid0_set_stripe (const char *sectors);
+void raid0_init (void);
+void raid0_bench (char **argv);
+
+#endif /* devices/raid0.h */
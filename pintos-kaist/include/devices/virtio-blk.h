@@ -0,0 +1,12 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+/* PCI slot of the virtio-blk device that stands in for the disk at
+   position POS, where positions 0 to 3 are hd0:0, hd0:1, hd1:0 and
+   hd1:1.  utils/pintos places its virtio disks this way. */
+#define VIRTIO_BLK_SLOT(POS) (0x10 + (POS))
+
+void virtio_blk_init (void);
+void virtio_blk_print_stats (void);
+
+#endif /* devices/virtio-blk.h */
@@ -0,0 +1,20 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (disk_sector_t, void *buffer, size_t ofs, size_t size);
+void cache_write (disk_sector_t, const void *buffer, size_t ofs, size_t size);
+void cache_write_meta (disk_sector_t, const void *buffer, size_t ofs,
+		size_t size);
+void cache_readahead (disk_sector_t);
+void cache_flush (void);
+void cache_flush_meta (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,19 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Number of name lookups remembered by the dentry cache. */
+#define DCACHE_SIZE 128
+
+/* Inode sector recorded for a name known not to exist. */
+#define DCACHE_NONE ((disk_sector_t) -1)
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *);
+void dcache_insert (disk_sector_t dir, const char *name, disk_sector_t);
+void dcache_purge (disk_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -14,10 +14,12 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define EOChain 0x0FFFFFFF   /* End of cluster chain */
 
 /* Sectors of FAT information. */
-#define SECTORS_PER_CLUSTER 1 /* Number of sectors per cluster */
+#define SECTORS_PER_CLUSTER 8 /* Default sectors per cluster (4 kB) */
+#define MAX_SECTORS_PER_CLUSTER 128 /* Largest cluster, 64 kB */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
 
+void fat_set_cluster_size (unsigned sectors);
 void fat_init (void);
 void fat_open (void);
 void fat_close (void);
@@ -35,4 +37,15 @@ cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
 
+/* A remembered position in a cluster chain, kept by an open file so that
+ * sequential access does not walk the chain from its head. */
+struct fat_pos {
+	cluster_t start;             /* First cluster of the chain. */
+	size_t idx;                  /* Index of CLST within the chain. */
+	cluster_t clst;              /* Cluster at IDX. */
+};
+
+void fat_pos_init (struct fat_pos *, cluster_t start);
+cluster_t fat_pos_seek (struct fat_pos *, size_t idx);
+
 #endif /* filesys/fat.h */
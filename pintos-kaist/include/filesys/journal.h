@@ -0,0 +1,23 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Size of the journal region, in sectors, including its superblock.
+ * The region starts at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+void journal_init (bool format);
+bool journal_active (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_log (disk_sector_t, const void *data);
+bool journal_read (disk_sector_t, void *data);
+void journal_revoke (disk_sector_t, size_t cnt);
+void journal_commit (void);
+void journal_done (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
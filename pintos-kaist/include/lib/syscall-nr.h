@@ -36,6 +36,10 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Project 3 extensions. */
+	SYS_MADVISE,                /* Give advice about use of memory. */
+	SYS_MSYNC,                  /* Write back a memory mapping. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -109,6 +109,10 @@ struct thread {
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
 #endif
+#ifdef FILESYS
+	/* Owned by filesys/journal.c. */
+	int journal_depth;                  /* Nesting of journal operations. */
+#endif
 
 	/* Owned by thread.c. */
 	struct intr_frame tf;               /* Information for switching */
@@ -1,12 +1,19 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
 enum vm_type;
 
 struct file_page {
+	struct file *file;          /* Mapped file. */
+	off_t offset;               /* Offset of the page in FILE. */
+	size_t read_bytes;          /* Bytes of FILE backing the page. */
+	uint64_t *pml4;             /* Page table of the mapping process. */
+	struct list_elem wb_elem;   /* Element in the writeback list. */
 };
 
 void vm_file_init (void);
@@ -14,4 +21,6 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void file_unmap_all (struct supplemental_page_table *spt);
+bool do_msync (void *addr, size_t length);
 #endif
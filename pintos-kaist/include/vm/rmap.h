@@ -0,0 +1,19 @@
+#ifndef VM_RMAP_H
+#define VM_RMAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "vm/vm.h"
+
+struct frame;
+struct page;
+
+void vm_rmap_init (void);
+void rmap_init (struct frame *frame);
+bool rmap_add (struct frame *frame, uint64_t *pml4, struct page *page);
+void rmap_remove (struct frame *frame, uint64_t *pml4, struct page *page);
+size_t rmap_unmap_all (struct frame *frame);
+bool rmap_is_dirty (struct frame *frame);
+bool rmap_test_and_clear_accessed (struct frame *frame);
+void rmap_print_stats (void);
+#endif
@@ -0,0 +1,17 @@
+#ifndef VM_TEXT_H
+#define VM_TEXT_H
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct page;
+struct frame;
+struct inode;
+
+void vm_text_init (void);
+bool text_map (struct page *page, struct inode *inode, off_t ofs);
+void text_register (struct frame *frame, struct inode *inode, off_t ofs);
+bool text_release (struct frame *frame);
+void text_evict (struct frame *frame);
+size_t text_frame_cnt (void);
+#endif
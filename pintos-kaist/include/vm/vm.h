@@ -1,6 +1,8 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -24,6 +26,22 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Access-pattern advice given through madvise().
+ * Values must match MADV_* in lib/user/syscall.h. */
+enum vm_advice {
+	/* No special treatment. */
+	VM_ADV_NORMAL = 0,
+	/* Random references: no fault-around, reclaimed without a second
+	 * chance. */
+	VM_ADV_RANDOM = 1,
+	/* Sequential references: fault-around ahead of the faulting page. */
+	VM_ADV_SEQUENTIAL = 2,
+	/* Prefetch the range now. */
+	VM_ADV_WILLNEED = 3,
+	/* Drop the frames and swap slots of the range. */
+	VM_ADV_DONTNEED = 4,
+};
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
@@ -46,6 +64,9 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem; /* Element in the owner's SPT. */
+	bool writable;         /* May the process write to it? */
+	enum vm_advice advice; /* Access hint set by madvise(). */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,6 +84,18 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;        /* Element in the frame table. */
+	int pin_cnt;                  /* Pins keeping it from eviction. */
+
+	/* Reverse mapping, see vm/rmap.c. */
+	struct list rmap;             /* (pml4, va) pairs that map the frame. */
+	size_t rmap_len;              /* Number of entries in RMAP. */
+
+	/* Shared read-only text, see vm/text.c. */
+	struct hash_elem text_elem;   /* Element in the shared text table. */
+	struct inode *text_inode;     /* Executable, or NULL if not shared. */
+	off_t text_ofs;               /* Offset of the page in TEXT_INODE. */
+	int text_cnt;                 /* Number of pages mapping this frame. */
 };
 
 /* The function table for page operations.
@@ -85,6 +118,8 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;          /* Pages keyed by user virtual address. */
+	struct file *exec;          /* Executable its segment pages load from. */
 };
 
 #include "threads/thread.h"
@@ -98,6 +133,8 @@ bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+void vm_disable_reclaim (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +144,10 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_release_frame (struct page *page);
+struct frame *vm_pin_frame (struct page *page);
+void vm_unpin_frame (struct frame *frame);
+bool do_madvise (void *addr, size_t length, enum vm_advice advice);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -326,6 +326,26 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold the CNT bits starting at START
+   to the same place in FILE, which must already hold the rest of
+   B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+		size_t start, size_t cnt) {
+	off_t ofs, size;
+
+	ASSERT (b != NULL);
+	ASSERT (start <= b->bit_cnt);
+	ASSERT (cnt <= b->bit_cnt - start);
+
+	if (cnt == 0)
+		return true;
+	ofs = start / CHAR_BIT;
+	size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+		== size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
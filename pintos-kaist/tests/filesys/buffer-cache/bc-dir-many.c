@@ -0,0 +1,42 @@
+/* Creates FILE_CNT files in one directory and then opens each of them,
+   checking that the directory's hash index keeps the disk traffic of a
+   lookup to a few sectors no matter how large the directory grows. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 1000
+
+void
+test_main (void) {
+  char name[16];
+  long long read_cnt;
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+  msg ("created %d files", FILE_CNT);
+
+  read_cnt = get_fs_disk_read_cnt ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "f%d", i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+  msg ("opened %d files", FILE_CNT);
+
+  /* Each lookup reads at most its bucket block and the file's inode. */
+  CHECK (get_fs_disk_read_cnt () - read_cnt <= 2 * FILE_CNT,
+         "check read_cnt");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bc-dir-many) begin
+(bc-dir-many) created 1000 files
+(bc-dir-many) opened 1000 files
+(bc-dir-many) check read_cnt
+(bc-dir-many) end
+EOF
+pass;
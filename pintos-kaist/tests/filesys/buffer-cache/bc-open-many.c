@@ -0,0 +1,55 @@
+/* Keeps HELD_CNT files open at once, so that the kernel's table of open
+   inodes holds many entries, and then opens each of them a second
+   time. Checks that both opens share one inode: a write that extends
+   the file through the first descriptor is seen at once through the
+   second. A second in-memory inode would keep the stale length. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HELD_CNT 64
+
+void
+test_main (void) {
+  int fds[HELD_CNT];
+  char name[16];
+  char buf[16];
+  int i;
+
+  for (i = 0; i < HELD_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+      fds[i] = open (name);
+      if (fds[i] < 2)
+        fail ("open \"%s\"", name);
+    }
+  msg ("opened %d files", HELD_CNT);
+
+  for (i = 0; i < HELD_CNT; i++)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "f%d", i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("reopen \"%s\"", name);
+      if (write (fds[i], name, sizeof name) != sizeof name)
+        fail ("write \"%s\"", name);
+      if (filesize (fd) != sizeof name)
+        fail ("\"%s\" has size %d through its second descriptor",
+              name, filesize (fd));
+      if (read (fd, buf, sizeof buf) != sizeof buf
+          || memcmp (buf, name, sizeof buf))
+        fail ("\"%s\" reads back differently", name);
+      close (fd);
+    }
+  msg ("reopened %d files", HELD_CNT);
+
+  for (i = 0; i < HELD_CNT; i++)
+    close (fds[i]);
+}
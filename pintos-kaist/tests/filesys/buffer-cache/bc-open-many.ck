@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bc-open-many) begin
+(bc-open-many) opened 64 files
+(bc-open-many) reopened 64 files
+(bc-open-many) end
+EOF
+pass;
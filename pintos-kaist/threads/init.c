@@ -34,8 +34,16 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "devices/ide.h"
+#include "devices/raid0.h"
+#include "devices/ramdisk.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/fat.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -216,11 +224,45 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+		else if (!strcmp (name, "-iosched")) {
+			if (value == NULL || !ide_set_scheduler (value))
+				PANIC ("unknown I/O scheduler `%s'", value);
+		}
+		else if (!strcmp (name, "-filesys") || !strcmp (name, "-scratch")
+				|| !strcmp (name, "-swap")) {
+			enum disk_role role = (!strcmp (name, "-filesys") ? DISK_FILESYS
+					: !strcmp (name, "-scratch") ? DISK_SCRATCH : DISK_SWAP);
+			if (value == NULL || !disk_set_role (role, value))
+				PANIC ("bad disk name `%s' (use -h for help)", value);
+		}
+		else if (!strcmp (name, "-raid0")) {
+			if (value == NULL || !raid0_configure (value))
+				PANIC ("bad RAID-0 member list `%s' (use -h for help)", value);
+		}
+		else if (!strcmp (name, "-stripe")) {
+			if (value == NULL || !raid0_set_stripe (value))
+				PANIC ("bad stripe size `%s' (use -h for help)", value);
+		}
+		else if (!strcmp (name, "-ramdisk")) {
+			if (value == NULL || !ramdisk_configure (value))
+				PANIC ("bad RAM disk `%s' (use -h for help)", value);
+		}
+#endif
+#ifdef EFILESYS
+		else if (!strcmp (name, "-cluster")) {
+			if (value == NULL)
+				PANIC ("missing cluster size (use -h for help)");
+			fat_set_cluster_size (atoi (value));
+		}
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+#ifdef VM
+		else if (!strcmp (name, "-no-reclaimd"))
+			vm_disable_reclaim ();
+#endif
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -270,6 +312,7 @@ run_actions (char **argv) {
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
 		{"rm", 2, fsutil_rm},
+		{"raid0-bench", 1, raid0_bench},
 		{"put", 2, fsutil_put},
 		{"get", 2, fsutil_get},
 #endif
@@ -316,6 +359,7 @@ usage (void) {
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
 			"  rm FILE            Delete FILE.\n"
+			"  raid0-bench        Compare md0's read throughput with its disks'.\n"
 			"Use these actions indirectly via `pintos' -g and -p options:\n"
 			"  put FILE           Put FILE into file system from scratch disk.\n"
 			"  get FILE           Get FILE from file system into scratch disk.\n"
@@ -324,10 +368,25 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+			"  -iosched=NAME      Use I/O scheduler NAME: noop, clook or deadline.\n"
+			"  -ramdisk=DISK:MB   Put DISK (fs, scratch or swap) in MB MB of RAM.\n"
+			"  -filesys=DISK      Use DISK, e.g. hd0:1p1, for the file system.\n"
+			"  -scratch=DISK      Use DISK for the scratch disk.\n"
+			"  -swap=DISK         Use DISK for swap.\n"
+			"  -raid0=DISK,DISK   Stripe disk md0 across the DISKs.\n"
+			"  -stripe=SECTORS    Use SECTORS-sector stripes for md0.\n"
+#endif
+#ifdef EFILESYS
+			"  -cluster=SECTORS   Format with SECTORS-sector FAT clusters.\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -no-reclaimd       Evict only when a fault finds no free frame.\n"
 #endif
 			);
 	power_off ();
@@ -356,10 +415,17 @@ print_stats (void) {
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	cache_print_stats ();
+	dcache_print_stats ();
+	free_map_print_stats ();
+	journal_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
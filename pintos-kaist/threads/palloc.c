@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -30,6 +31,7 @@
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
+	size_t free_cnt;                /* Number of free pages in used_map. */
 	uint8_t *base;                  /* Base of pool. */
 };
 
@@ -224,11 +226,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 			}
 		}
 	}
@@ -265,6 +269,11 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 
 	lock_acquire (&pool->lock);
 	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR) {
+		enum intr_level old_level = intr_disable ();
+		pool->free_cnt -= page_cnt;
+		intr_set_level (old_level);
+	}
 	lock_release (&pool->lock);
 	void *pages;
 
@@ -301,6 +310,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -320,6 +330,13 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+	/* Pages are freed without the pool lock, even by the scheduler with
+	   interrupts off, so FREE_CNT is kept consistent by disabling
+	   interrupts instead. */
+	old_level = intr_disable ();
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +345,15 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool.
+   Reads the counter without the pool lock, so the result may be stale
+   by the time the caller looks at it, which is fine for deciding when
+   to reclaim. */
+size_t
+palloc_user_free_cnt (void) {
+	return user_pool.free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -340,6 +366,7 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->free_cnt = 0;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
@@ -19,7 +19,9 @@
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #ifdef VM
+#include "threads/malloc.h"
 #include "vm/vm.h"
+#include "vm/text.h"
 #endif
 
 static void process_cleanup (void);
@@ -574,11 +576,32 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* What lazy_load_segment() needs to fill one page of a segment. */
+struct segment_page {
+	struct file *file;          /* Executable, owned by the SPT. */
+	off_t ofs;                  /* Offset of the page in FILE. */
+	size_t read_bytes;          /* Bytes to read; the rest is zeroed. */
+	bool shared;                /* Read-only text that others may share. */
+};
+
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct segment_page *sp = aux;
+	uint8_t *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (sp->file, kva, sp->read_bytes, sp->ofs)
+		== (off_t) sp->read_bytes;
+	if (success) {
+		memset (kva + sp->read_bytes, 0, PGSIZE - sp->read_bytes);
+
+		/* Let later processes running the same binary map this frame
+		 * instead of reading the page again. */
+		if (sp->shared)
+			text_register (page->frame, file_get_inode (sp->file), sp->ofs);
+	}
+	free (sp);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -598,10 +621,20 @@ lazy_load_segment (struct page *page, void *aux) {
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+
 	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	/* All segment pages read from one reopened copy of the executable,
+	 * which lives until supplemental_page_table_kill(). */
+	if (spt->exec == NULL) {
+		spt->exec = file_reopen (file);
+		if (spt->exec == NULL)
+			return false;
+	}
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
@@ -609,15 +642,31 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
+		struct segment_page *aux = malloc (sizeof *aux);
+		if (aux == NULL)
+			return false;
+		aux->file = spt->exec;
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
+		/* Only whole pages of read-only segments are shared: a partial
+		 * page at a segment edge holds zeros where another segment that
+		 * covers the same file page has data. */
+		aux->shared = !writable && page_read_bytes == PGSIZE;
 		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+					writable, lazy_load_segment, aux)) {
+			free (aux);
 			return false;
+		}
+
+		/* If another process already has the page resident, map its frame
+		 * now. Otherwise the first fault loads and publishes it. */
+		if (aux->shared)
+			text_map (spt_find_page (spt, upage), file_get_inode (file), ofs);
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
 		upage += PGSIZE;
 	}
 	return true;
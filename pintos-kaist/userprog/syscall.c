@@ -7,6 +7,9 @@
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -40,6 +43,19 @@ syscall_init (void) {
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f UNUSED) {
+	switch (f->R.rax) {
+#ifdef VM
+		case SYS_MADVISE:
+			f->R.rax = do_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx) ? 0 : -1;
+			return;
+		case SYS_MSYNC:
+			f->R.rax = do_msync ((void *) f->R.rdi, f->R.rsi) ? 0 : -1;
+			return;
+#endif
+		default:
+			break;
+	}
+
 	// TODO: Your implementation goes here.
 	printf ("system call!\n");
 	thread_exit ();
@@ -1,7 +1,9 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -21,7 +23,7 @@ static const struct page_operations anon_ops = {
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get_role (DISK_SWAP);
 }
 
 /* Initialize the file mapping */
@@ -31,6 +33,11 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+
+	/* A fresh anonymous page reads as zeros. A lazy loader passed to
+	 * vm_alloc_page_with_initializer() then fills in its contents. */
+	memset (kva, 0, PGSIZE);
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
@@ -49,4 +56,6 @@ anon_swap_out (struct page *page) {
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	vm_release_frame (page);
 }
@@ -1,6 +1,15 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,45 +23,419 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Periodic writeback.
+ * Every resident file-backed page is on wb_pages. Every WB_INTERVAL ticks
+ * the writeback daemon writes the dirty ones back, so a process with large
+ * dirty mappings does not flush everything at munmap or exit, and a crash
+ * loses at most one interval of changes.
+ * wb_lock protects only the list. Dirty pages are picked under it in
+ * batches of up to WB_BATCH_PAGES, with their frames pinned, and the lock
+ * is dropped before the batch is written. Pinning takes frame_lock, so
+ * wb_lock orders before frame_lock; no path that holds frame_lock,
+ * eviction included, may take wb_lock. */
+#define WB_INTERVAL (5 * TIMER_FREQ)
+#define WB_BATCH_PAGES 32
+static struct list wb_pages;
+static size_t wb_page_cnt;
+static struct lock wb_lock;
+
+/* A dirty page picked for writeback. */
+struct wb_entry {
+	struct frame *frame;        /* Pinned frame holding the data. */
+	struct file *file;          /* File to write. */
+	off_t offset;               /* Offset of the page in FILE. */
+	size_t length;              /* Bytes of FILE backing the page. */
+};
+
+/* Pages picked for writeback. They are written in file and offset order,
+ * and pages that are adjacent in a file are gathered into runs of up to
+ * WB_RUN_PAGES pages, each written with one file_write_at(). */
+#define WB_RUN_PAGES 8
+struct wb_batch {
+	struct wb_entry entries[WB_BATCH_PAGES];
+	size_t cnt;                 /* Number of entries in use. */
+	uint8_t *buffer;            /* WB_RUN_PAGES pages to gather a run in. */
+};
+
+static void file_writebackd (void *aux);
+static struct wb_batch *wb_batch_create (void);
+static void wb_batch_destroy (struct wb_batch *batch);
+static void wb_batch_add (struct wb_batch *batch, struct page *page);
+static void wb_batch_write (struct wb_batch *batch);
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	list_init (&wb_pages);
+	lock_init (&wb_lock);
+	if (thread_create ("writebackd", PRI_DEFAULT, file_writebackd, NULL)
+			== TID_ERROR)
+		PANIC ("writeback daemon creation failed");
 }
 
 /* Initialize the file backed page */
 bool
 file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+	/* do_mmap() passes the page's place in the file as the uninit page's
+	 * aux, which shares storage with PAGE->file, so fetch it first. */
+	struct file_page *src = page->uninit.aux;
+
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->file = src->file;
+	file_page->offset = src->offset;
+	file_page->read_bytes = src->read_bytes;
+	file_page->pml4 = thread_current ()->pml4;
+	free (src);
+
+	lock_acquire (&wb_lock);
+	list_push_back (&wb_pages, &file_page->wb_elem);
+	wb_page_cnt++;
+	lock_release (&wb_lock);
+
+	return file_backed_swap_in (page, kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->offset) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (page->frame != NULL && pml4_is_dirty (file_page->pml4, page->va)) {
+		pml4_set_dirty (file_page->pml4, page->va, false);
+		file_write_at (file_page->file, page->frame->kva,
+				file_page->read_bytes, file_page->offset);
+	}
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	lock_acquire (&wb_lock);
+	list_remove (&file_page->wb_elem);
+	wb_page_cnt--;
+	lock_release (&wb_lock);
+
+	if (page->frame != NULL) {
+		file_backed_swap_out (page);
+		vm_release_frame (page);
+	}
+}
+
+/* Returns the file that PAGE, a page of an mmap'd region, maps. */
+static struct file *
+page_mapped_file (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return ((struct file_page *) page->uninit.aux)->file;
+	return page->file.file;
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr;
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	off_t file_len = file_length (file);
+	struct file *mapped;
+	size_t i;
+
+	if (start == NULL || pg_ofs (start) != 0 || length == 0
+			|| start + length < start || !is_user_vaddr (start)
+			|| !is_user_vaddr (start + length - 1)
+			|| offset < 0 || offset % PGSIZE != 0 || file_len == 0)
+		return NULL;
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, start + i * PGSIZE) != NULL)
+			return NULL;
+
+	/* All pages of the mapping share one reopened file, which do_munmap()
+	 * closes. */
+	mapped = file_reopen (file);
+	if (mapped == NULL)
+		return NULL;
+	for (i = 0; i < page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		off_t left = file_len > ofs ? file_len - ofs : 0;
+		struct file_page *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			break;
+		aux->file = mapped;
+		aux->offset = ofs;
+		aux->read_bytes = left < PGSIZE ? left : PGSIZE;
+		if (!vm_alloc_page_with_initializer (VM_FILE, start + i * PGSIZE,
+					writable, NULL, aux)) {
+			free (aux);
+			break;
+		}
+	}
+	if (i < page_cnt) {
+		if (i > 0)
+			do_munmap (start);
+		else
+			file_close (mapped);
+		return NULL;
+	}
+	return start;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, addr);
+	struct page *prev;
+	struct file *file;
+	uint8_t *upage;
+
+	if (page == NULL || page_get_type (page) != VM_FILE)
+		return;
+
+	/* ADDR must be the first page of the mapping. */
+	file = page_mapped_file (page);
+	prev = spt_find_page (spt, (uint8_t *) addr - PGSIZE);
+	if (prev != NULL && page_get_type (prev) == VM_FILE
+			&& page_mapped_file (prev) == file)
+		return;
+
+	/* Destroying each page writes it back if it is dirty. */
+	for (upage = addr; (page = spt_find_page (spt, upage)) != NULL
+			&& page_get_type (page) == VM_FILE
+			&& page_mapped_file (page) == file; upage += PGSIZE)
+		spt_remove_page (spt, page);
+	file_close (file);
+}
+
+/* Unmaps every mapping left in SPT, writing back their dirty pages and
+ * closing their files. Called as the process's SPT is torn down. */
+void
+file_unmap_all (struct supplemental_page_table *spt) {
+	while (!hash_empty (&spt->pages)) {
+		struct hash_iterator i;
+		struct page *page = NULL;
+		struct page *prev;
+		struct file *file;
+
+		/* do_munmap() changes the table, so look afresh each time. */
+		hash_first (&i, &spt->pages);
+		while (hash_next (&i)) {
+			struct page *p = hash_entry (hash_cur (&i), struct page, spt_elem);
+			if (page_get_type (p) == VM_FILE) {
+				page = p;
+				break;
+			}
+		}
+		if (page == NULL)
+			break;
+
+		/* Back up to the first page of its mapping. */
+		file = page_mapped_file (page);
+		while ((prev = spt_find_page (spt, (uint8_t *) page->va - PGSIZE))
+				!= NULL && page_get_type (prev) == VM_FILE
+				&& page_mapped_file (prev) == file)
+			page = prev;
+		do_munmap (page->va);
+	}
+}
+
+/* Writes back the dirty file-backed pages in the LENGTH bytes starting at
+ * page-aligned ADDR in the current process. Anonymous and non-resident
+ * pages in the range are skipped.
+ * Returns false if the range is invalid or not fully mapped. */
+bool
+do_msync (void *addr, size_t length) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr;
+	uint8_t *end = start + length;
+	uint8_t *upage;
+	struct wb_batch *batch;
+
+	if (pg_ofs (addr) != 0 || length == 0 || end < start
+			|| !is_user_vaddr (start) || !is_user_vaddr (end - 1))
+		return false;
+	for (upage = start; upage < end; upage += PGSIZE)
+		if (spt_find_page (spt, upage) == NULL)
+			return false;
+
+	batch = wb_batch_create ();
+	if (batch == NULL)
+		return false;
+	for (upage = start; upage < end; ) {
+		lock_acquire (&wb_lock);
+		for (; upage < end && batch->cnt < WB_BATCH_PAGES; upage += PGSIZE) {
+			struct page *page = spt_find_page (spt, upage);
+			if (VM_TYPE (page->operations->type) == VM_FILE)
+				wb_batch_add (batch, page);
+		}
+		lock_release (&wb_lock);
+		wb_batch_write (batch);
+	}
+	wb_batch_destroy (batch);
+	return true;
+}
+
+/* Writeback daemon. Wakes every WB_INTERVAL ticks and writes back every
+ * dirty file-backed page in the system, one batch at a time. Each visited
+ * page moves to the back of wb_pages, so that every page is looked at
+ * once per pass even though the list can change between batches. */
+static void
+file_writebackd (void *aux UNUSED) {
+	struct wb_batch *batch = wb_batch_create ();
+
+	if (batch == NULL)
+		PANIC ("writeback buffer allocation failed");
+
+	for (;;) {
+		size_t left;
+
+		timer_sleep (WB_INTERVAL);
+
+		lock_acquire (&wb_lock);
+		left = wb_page_cnt;
+		lock_release (&wb_lock);
+
+		while (left > 0) {
+			lock_acquire (&wb_lock);
+			while (left > 0 && batch->cnt < WB_BATCH_PAGES) {
+				struct list_elem *e;
+
+				if (list_empty (&wb_pages)) {
+					left = 0;
+					break;
+				}
+				e = list_pop_front (&wb_pages);
+				list_push_back (&wb_pages, e);
+				wb_batch_add (batch, list_entry (e, struct page, file.wb_elem));
+				left--;
+			}
+			lock_release (&wb_lock);
+			wb_batch_write (batch);
+		}
+	}
+}
+
+/* Returns a new, empty writeback batch, or a null pointer if memory
+ * allocation fails. */
+static struct wb_batch *
+wb_batch_create (void) {
+	struct wb_batch *batch = malloc (sizeof *batch);
+
+	if (batch == NULL)
+		return NULL;
+	batch->cnt = 0;
+	batch->buffer = palloc_get_multiple (0, WB_RUN_PAGES);
+	if (batch->buffer == NULL) {
+		free (batch);
+		return NULL;
+	}
+	return batch;
+}
+
+/* Frees BATCH, which must be empty. */
+static void
+wb_batch_destroy (struct wb_batch *batch) {
+	ASSERT (batch->cnt == 0);
+	palloc_free_multiple (batch->buffer, WB_RUN_PAGES);
+	free (batch);
+}
+
+/* Adds PAGE to BATCH if it is resident and dirty, pinning its frame so
+ * that it can be read after wb_lock is dropped. Clears the dirty bit
+ * first, so that a store racing with writeback dirties the page again
+ * instead of being lost. Must be called with wb_lock held, which keeps
+ * PAGE from being destroyed. */
+static void
+wb_batch_add (struct wb_batch *batch, struct page *page) {
+	struct file_page *file_page = &page->file;
+	struct frame *frame;
+
+	ASSERT (batch->cnt < WB_BATCH_PAGES);
+
+	if (file_page->read_bytes == 0
+			|| !pml4_is_dirty (file_page->pml4, page->va))
+		return;
+	frame = vm_pin_frame (page);
+	if (frame == NULL)
+		return;
+	pml4_set_dirty (file_page->pml4, page->va, false);
+
+	batch->entries[batch->cnt++] = (struct wb_entry) {
+		.frame = frame,
+		.file = file_page->file,
+		.offset = file_page->offset,
+		.length = file_page->read_bytes,
+	};
+}
+
+/* Returns true if writeback entry A goes before B: by file, then by
+ * offset. */
+static bool
+wb_entry_less (const struct wb_entry *a, const struct wb_entry *b) {
+	if (a->file != b->file)
+		return a->file < b->file;
+	return a->offset < b->offset;
+}
+
+/* Writes the pages in BATCH to their files, coalescing pages that are
+ * adjacent in a file, then unpins them and empties BATCH. The pinned
+ * frames cannot be evicted or freed, and the files outlive the pages that
+ * map them, so no lock is needed here. */
+static void
+wb_batch_write (struct wb_batch *batch) {
+	size_t i, j;
+
+	/* Sort into file and offset order. */
+	for (i = 1; i < batch->cnt; i++) {
+		struct wb_entry e = batch->entries[i];
+
+		for (j = i; j > 0 && wb_entry_less (&e, &batch->entries[j - 1]); j--)
+			batch->entries[j] = batch->entries[j - 1];
+		batch->entries[j] = e;
+	}
+
+	for (i = 0; i < batch->cnt; i = j) {
+		struct wb_entry *first = &batch->entries[i];
+		size_t length = 0;
+
+		/* Gather the run of pages that continue FIRST in its file. A page
+		 * that ends before a page boundary also ends the run. */
+		for (j = i; j < batch->cnt && j - i < WB_RUN_PAGES; j++) {
+			struct wb_entry *e = &batch->entries[j];
+
+			if (e->file != first->file
+					|| e->offset != first->offset + (off_t) length)
+				break;
+			memcpy (batch->buffer + length, e->frame->kva, e->length);
+			length += e->length;
+			if (e->length < PGSIZE) {
+				j++;
+				break;
+			}
+		}
+		file_write_at (first->file, batch->buffer, length, first->offset);
+	}
+
+	for (i = 0; i < batch->cnt; i++)
+		vm_unpin_frame (batch->entries[i].frame);
+	batch->cnt = 0;
 }
@@ -0,0 +1,153 @@
+/* rmap.c: Reverse mapping from frames to the page tables that map them.
+ *
+ * Once a frame can be mapped by more than one process (shared text, and
+ * later copy-on-write), evicting or unmapping it means clearing every PTE
+ * that points at it and unlinking every page that uses it. Each frame
+ * keeps a list of its mappings, each a page and the page table it lives
+ * in, so those paths take time linear in the number of sharers instead
+ * of scanning every process's page table. */
+
+#include "vm/rmap.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+
+/* One mapping of a frame: PAGE, at its address in page table PML4. */
+struct rmap_entry {
+	uint64_t *pml4;             /* Page table holding the mapping. */
+	struct page *page;          /* Page whose frame this is. */
+	struct list_elem elem;      /* Element in frame's rmap list. */
+};
+
+/* Protects every frame's rmap list. */
+static struct lock rmap_lock;
+
+/* Statistics. */
+static long long add_cnt;       /* # of mappings recorded. */
+static long long unmap_cnt;     /* # of calls to rmap_unmap_all(). */
+static long long unmap_pte_cnt; /* # of PTEs cleared by rmap_unmap_all(). */
+static size_t max_len;          /* Longest rmap list seen. */
+
+/* Initializes the reverse mapping module. */
+void
+vm_rmap_init (void) {
+	lock_init (&rmap_lock);
+}
+
+/* Initializes FRAME's reverse mapping as empty. */
+void
+rmap_init (struct frame *frame) {
+	list_init (&frame->rmap);
+	frame->rmap_len = 0;
+}
+
+/* Records that PAGE, mapped in PML4, uses FRAME.
+ * Returns false if memory allocation fails. */
+bool
+rmap_add (struct frame *frame, uint64_t *pml4, struct page *page) {
+	struct rmap_entry *r = malloc (sizeof *r);
+	if (r == NULL)
+		return false;
+	r->pml4 = pml4;
+	r->page = page;
+
+	lock_acquire (&rmap_lock);
+	list_push_back (&frame->rmap, &r->elem);
+	if (++frame->rmap_len > max_len)
+		max_len = frame->rmap_len;
+	add_cnt++;
+	lock_release (&rmap_lock);
+	return true;
+}
+
+/* Removes the mapping of FRAME by PAGE in PML4, clearing its PTE. */
+void
+rmap_remove (struct frame *frame, uint64_t *pml4, struct page *page) {
+	struct rmap_entry *found = NULL;
+	struct list_elem *e;
+
+	lock_acquire (&rmap_lock);
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap);
+			e = list_next (e)) {
+		struct rmap_entry *r = list_entry (e, struct rmap_entry, elem);
+		if (r->pml4 == pml4 && r->page == page) {
+			list_remove (&r->elem);
+			frame->rmap_len--;
+			found = r;
+			break;
+		}
+	}
+	lock_release (&rmap_lock);
+
+	pml4_clear_page (pml4, page->va);
+	free (found);
+}
+
+/* Clears every PTE that maps FRAME, unlinks every page that uses it and
+ * forgets the mappings. Returns the number of PTEs cleared. */
+size_t
+rmap_unmap_all (struct frame *frame) {
+	size_t cnt = 0;
+
+	lock_acquire (&rmap_lock);
+	while (!list_empty (&frame->rmap)) {
+		struct rmap_entry *r = list_entry (list_pop_front (&frame->rmap),
+				struct rmap_entry, elem);
+		pml4_clear_page (r->pml4, r->page->va);
+		r->page->frame = NULL;
+		free (r);
+		cnt++;
+	}
+	frame->rmap_len = 0;
+	unmap_cnt++;
+	unmap_pte_cnt += cnt;
+	lock_release (&rmap_lock);
+	return cnt;
+}
+
+/* Returns true if any mapping of FRAME has been written to. */
+bool
+rmap_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+	bool dirty = false;
+
+	lock_acquire (&rmap_lock);
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap) && !dirty;
+			e = list_next (e)) {
+		struct rmap_entry *r = list_entry (e, struct rmap_entry, elem);
+		dirty = pml4_is_dirty (r->pml4, r->page->va);
+	}
+	lock_release (&rmap_lock);
+	return dirty;
+}
+
+/* Returns true if any mapping of FRAME has been accessed since the last
+ * call, and clears the accessed bit of all of them. Suits a clock-style
+ * victim search over shared frames. */
+bool
+rmap_test_and_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	lock_acquire (&rmap_lock);
+	for (e = list_begin (&frame->rmap); e != list_end (&frame->rmap);
+			e = list_next (e)) {
+		struct rmap_entry *r = list_entry (e, struct rmap_entry, elem);
+		if (pml4_is_accessed (r->pml4, r->page->va)) {
+			pml4_set_accessed (r->pml4, r->page->va, false);
+			accessed = true;
+		}
+	}
+	lock_release (&rmap_lock);
+	return accessed;
+}
+
+/* Prints reverse mapping statistics. */
+void
+rmap_print_stats (void) {
+	printf ("Rmap: %lld mappings, %lld unmaps clearing %lld PTEs, "
+			"longest rmap %zu\n", add_cnt, unmap_cnt, unmap_pte_cnt, max_len);
+}
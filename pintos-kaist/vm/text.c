@@ -0,0 +1,162 @@
+/* text.c: Sharing of read-only executable pages between processes.
+ *
+ * Every process that runs the same binary maps the same read-only PT_LOAD
+ * pages. Instead of reading them into a private frame per process, the
+ * first loader registers its frame here under the executable's inode and
+ * the page's file offset, and later loaders map that frame read-only.
+ * The frame stays resident until the last page mapping it is destroyed. */
+
+#include "vm/text.h"
+#include <hash.h>
+#include "filesys/inode.h"
+#include "vm/rmap.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Resident text frames, keyed by (inode sector, file offset). */
+static struct hash text_frames;
+static struct lock text_lock;
+
+static uint64_t text_hash (const struct hash_elem *e, void *aux);
+static bool text_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+
+/* Initializes the shared text table. */
+void
+vm_text_init (void) {
+	hash_init (&text_frames, text_hash, text_less, NULL);
+	lock_init (&text_lock);
+}
+
+/* Maps the resident copy of the page at OFS in INODE into PAGE, read-only,
+ * and takes a reference on its frame.
+ * Returns false if no process has that page resident, in which case the
+ * caller loads it into a fresh frame and passes it to text_register(). */
+bool
+text_map (struct page *page, struct inode *inode, off_t ofs) {
+	struct frame key;
+	struct hash_elem *e;
+	bool success = false;
+
+	ASSERT (page->frame == NULL);
+
+	key.text_inode = inode;
+	key.text_ofs = ofs;
+
+	lock_acquire (&text_lock);
+	e = hash_find (&text_frames, &key.text_elem);
+	if (e != NULL) {
+		struct frame *frame = hash_entry (e, struct frame, text_elem);
+		uint64_t *pml4 = thread_current ()->pml4;
+		if (pml4_set_page (pml4, page->va, frame->kva, false)) {
+			if (rmap_add (frame, pml4, page)) {
+				frame->text_cnt++;
+				page->frame = frame;
+				success = true;
+			} else
+				pml4_clear_page (pml4, page->va);
+		}
+	}
+	lock_release (&text_lock);
+	return success;
+}
+
+/* Publishes FRAME, which holds the freshly loaded page at OFS in INODE, so
+ * that other processes can share it. The caller's mapping is the first
+ * reference. If another process raced us and registered the same page
+ * first, FRAME simply stays private. */
+void
+text_register (struct frame *frame, struct inode *inode, off_t ofs) {
+	ASSERT (frame->text_inode == NULL);
+
+	frame->text_inode = inode;
+	frame->text_ofs = ofs;
+	frame->text_cnt = 1;
+
+	lock_acquire (&text_lock);
+	if (hash_insert (&text_frames, &frame->text_elem) == NULL)
+		inode_reopen (inode);
+	else
+		frame->text_inode = NULL;
+	lock_release (&text_lock);
+}
+
+/* Drops one reference to FRAME.
+ * Returns true if the caller held the last reference and must free the
+ * frame itself, false if other processes still map it. Frames that were
+ * never registered are always the caller's to free. */
+bool
+text_release (struct frame *frame) {
+	struct inode *inode = NULL;
+	bool last;
+
+	if (frame->text_inode == NULL)
+		return true;
+
+	lock_acquire (&text_lock);
+	last = --frame->text_cnt == 0;
+	if (last) {
+		hash_delete (&text_frames, &frame->text_elem);
+		inode = frame->text_inode;
+		frame->text_inode = NULL;
+	}
+	lock_release (&text_lock);
+
+	inode_close (inode);
+	return last;
+}
+
+/* Drops every reference to FRAME at once, because it is being evicted
+ * and all of its mappings go away together. Afterward no new process can
+ * map it through the table. */
+void
+text_evict (struct frame *frame) {
+	struct inode *inode;
+
+	if (frame->text_inode == NULL)
+		return;
+
+	lock_acquire (&text_lock);
+	hash_delete (&text_frames, &frame->text_elem);
+	inode = frame->text_inode;
+	frame->text_inode = NULL;
+	frame->text_cnt = 0;
+	lock_release (&text_lock);
+
+	inode_close (inode);
+}
+
+/* Returns the number of text frames currently shared through the table. */
+size_t
+text_frame_cnt (void) {
+	size_t cnt;
+
+	lock_acquire (&text_lock);
+	cnt = hash_size (&text_frames);
+	lock_release (&text_lock);
+	return cnt;
+}
+
+/* Returns a hash value for the text frame E. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *f = hash_entry (e, struct frame, text_elem);
+	disk_sector_t key[2] = { inode_get_inumber (f->text_inode), f->text_ofs };
+
+	return hash_bytes (key, sizeof key);
+}
+
+/* Returns true if text frame A precedes B. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+	disk_sector_t a_sector = inode_get_inumber (a->text_inode);
+	disk_sector_t b_sector = inode_get_inumber (b->text_inode);
+
+	if (a_sector != b_sector)
+		return a_sector < b_sector;
+	return a->text_ofs < b->text_ofs;
+}
@@ -10,6 +10,7 @@
 
 #include "vm/vm.h"
 #include "vm/uninit.h"
+#include "threads/malloc.h"
 
 static bool uninit_initialize (struct page *page, void *kva);
 static void uninit_destroy (struct page *page);
@@ -62,7 +63,13 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* A page that was never loaded still owns the aux its creator passed
+	 * to vm_alloc_page_with_initializer(), which the initializers would
+	 * have consumed. Every creator allocates it with malloc(). */
+	free (uninit->aux);
+
+	/* A text page can map a shared frame before it is ever loaded. */
+	vm_release_frame (page);
 }
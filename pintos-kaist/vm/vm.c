@@ -1,8 +1,30 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include "intrinsic.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/rmap.h"
+#include "vm/text.h"
+
+static void vm_reclaim_init (void);
+
+/* Frame table.
+ * Every frame that holds a user page is on frame_list, which the clock
+ * hand sweeps to pick eviction victims. frame_lock protects the list and
+ * also serializes eviction against a page giving up its frame.
+ * Lock order: wb_lock (vm/file.c), then frame_lock, then text_lock and
+ * rmap_lock. */
+static struct list frame_list;
+static struct lock frame_lock;
+static struct condition frame_unpinned; /* Signaled when a pin drops. */
+static struct list_elem *clock_hand;    /* Next frame the clock looks at. */
+static size_t frame_cnt;                /* Number of frames in frame_list. */
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,6 +37,12 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
+	list_init (&frame_list);
+	lock_init (&frame_lock);
+	cond_init (&frame_unpinned);
+	vm_rmap_init ();
+	vm_text_init ();
+	vm_reclaim_init ();
 	/* TODO: Your code goes here. */
 }
 
@@ -36,6 +64,44 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static void vm_put_frame (struct frame *frame);
+static void vm_free_frame (struct frame *frame);
+static void vm_fault_around (struct supplemental_page_table *spt, void *va);
+static void vm_discard_page (struct page *page);
+static void frame_table_remove (struct frame *frame);
+static uint64_t spt_hash (const struct hash_elem *e, void *aux);
+static bool spt_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+static void spt_destroy_page (struct hash_elem *e, void *aux);
+
+static void vm_reclaim_wake (void);
+static void vm_reclaimd (void *aux);
+
+/* Number of pages claimed ahead of a fault on a VM_ADV_SEQUENTIAL page. */
+#define FAULT_AROUND_PAGES 8
+
+/* Background reclaim.
+ * vm_get_frame() wakes the reclaim daemon once fewer than reclaim_low user
+ * frames are free. The daemon then evicts RECLAIM_BATCH frames at a time
+ * until reclaim_high frames are free, so a faulting thread normally finds
+ * a free frame instead of paying for the victim search and write-out. */
+#define RECLAIM_BATCH 16
+static size_t reclaim_low;              /* Wake the daemon below this. */
+static size_t reclaim_high;             /* Reclaim until this many are free. */
+static struct semaphore reclaim_sema;   /* Up'd to wake the daemon. */
+static bool reclaim_disabled;           /* Set by -no-reclaimd. */
+static bool reclaim_running;            /* Daemon is woken or working. */
+static long long reclaim_wakeup_cnt;    /* # of times the daemon was woken. */
+static long long reclaim_frame_cnt;     /* # of frames it reclaimed. */
+
+/* Cost of getting a frame in the fault path, in TSC cycles, split by
+ * whether a free frame was at hand or one had to be evicted on the spot.
+ * Comparing runs with and without -no-reclaimd shows what the daemon
+ * takes off the fault path. */
+static long long frame_fast_cnt;        /* # of frames taken from the pool. */
+static long long frame_slow_cnt;        /* # of frames evicted by faults. */
+static uint64_t frame_fast_cycles;      /* Cycles spent on the former. */
+static uint64_t frame_slow_cycles;      /* Cycles spent on the latter. */
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,11 +116,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
-
-		/* TODO: Insert the page into the spt. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->writable = writable;
+		page->advice = VM_ADV_NORMAL;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,46 +149,124 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Removes FRAME from the frame table, moving the clock hand past it if
+ * it points there. Must be called with frame_lock held. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+	frame_cnt--;
+}
+
+/* Get the struct frame, that will be evicted.
+ * The clock hand gives a frame that was accessed since its last visit a
+ * second chance, except that a page advised VM_ADV_RANDOM gets none, and
+ * skips frames that are still being loaded. The victim is removed from
+ * the frame table. Must be called with frame_lock held. */
 static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
 
+	for (i = 0; victim == NULL && i < 2 * frame_cnt; i++) {
+		struct frame *frame;
+
+		if (clock_hand == NULL || clock_hand == list_end (&frame_list))
+			clock_hand = list_begin (&frame_list);
+		frame = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
+
+		if (frame->pin_cnt > 0)
+			continue;
+		if (rmap_test_and_clear_accessed (frame)
+				&& (frame->page == NULL
+					|| frame->page->advice != VM_ADV_RANDOM))
+			continue;
+		victim = frame;
+	}
+	if (victim != NULL)
+		frame_table_remove (victim);
 	return victim;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ * frame_lock is dropped while the victim is written out, so that other
+ * faults and vm_pin_frame() callers do not wait on the disk. The victim is
+ * off the frame table by then, and pinned, so that vm_release_frame()
+ * waits for the write-out to finish before freeing its page. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-
-	return NULL;
+	struct frame *victim;
+	struct page *page;
+	bool saved;
+
+	lock_acquire (&frame_lock);
+	victim = vm_get_victim ();
+	if (victim == NULL) {
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	victim->pin_cnt++;
+	page = victim->page;
+	lock_release (&frame_lock);
+
+	saved = page == NULL || swap_out (page);
+
+	lock_acquire (&frame_lock);
+	/* Waiters run once we release frame_lock, by when the frame is either
+	 * back on the table or unmapped. */
+	if (--victim->pin_cnt == 0)
+		cond_broadcast (&frame_unpinned, &frame_lock);
+	/* Someone pinned the frame meanwhile, or a store that raced with the
+	 * write-out dirtied the page again, since file_backed_swap_out()
+	 * cleans it before writing. Either way it has to stay. */
+	if (saved && (victim->pin_cnt > 0
+				|| (victim->page != NULL
+					&& VM_TYPE (victim->page->operations->type) == VM_FILE
+					&& rmap_is_dirty (victim))))
+		saved = false;
+
+	if (!saved) {
+		/* Keep it resident and try another frame next time. */
+		list_push_back (&frame_list, &victim->elem);
+		frame_cnt++;
+		victim = NULL;
+	} else {
+		/* Leave the text table first, so that no process maps the
+		 * frame again once its mappings are gone. */
+		text_evict (victim);
+		rmap_unmap_all (victim);
+		victim->page = NULL;
+	}
+	lock_release (&frame_lock);
+	return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
@@ -111,13 +276,210 @@ vm_evict_frame (void) {
 static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	uint64_t start = rdtsc ();
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kva != NULL) {
+		frame = malloc (sizeof *frame);
+		if (frame != NULL)
+			frame->kva = kva;
+		else
+			palloc_free_page (kva);
+	}
+	if (frame != NULL) {
+		frame_fast_cnt++;
+		frame_fast_cycles += rdtsc () - start;
+	} else {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			PANIC ("out of user frames");
+		frame_slow_cnt++;
+		frame_slow_cycles += rdtsc () - start;
+	}
 
+	/* The frame joins the frame table pinned, so that it cannot be picked
+	 * as a victim until vm_do_claim_page() has loaded it. */
+	frame->page = NULL;
+	frame->pin_cnt = 1;
+	frame->text_inode = NULL;
+	frame->text_cnt = 0;
+	rmap_init (frame);
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_list, &frame->elem);
+	frame_cnt++;
+	lock_release (&frame_lock);
+
+	vm_reclaim_wake ();
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
+/* Keeps the reclaim daemon from starting, so that faults evict frames
+ * themselves. For comparing fault latency with and without it. */
+void
+vm_disable_reclaim (void) {
+	reclaim_disabled = true;
+}
+
+/* Sets the free-frame watermarks from the size of the user pool, which is
+ * entirely free at boot, and starts the reclaim daemon. */
+static void
+vm_reclaim_init (void) {
+	size_t user_pages = palloc_user_free_cnt ();
+
+	if (reclaim_disabled)
+		return;
+
+	reclaim_low = user_pages / 32;
+	if (reclaim_low < RECLAIM_BATCH)
+		reclaim_low = RECLAIM_BATCH;
+	reclaim_high = reclaim_low * 2;
+	sema_init (&reclaim_sema, 0);
+	reclaim_running = false;
+
+	if (thread_create ("reclaimd", PRI_DEFAULT, vm_reclaimd, NULL)
+			== TID_ERROR)
+		PANIC ("reclaim daemon creation failed");
+}
+
+/* Prints statistics about frame allocation and background reclaim. */
+void
+vm_print_stats (void) {
+	printf ("Frames: %lld from pool (%llu cycles avg), "
+			"%lld evicted by faults (%llu cycles avg)\n",
+			frame_fast_cnt,
+			frame_fast_cnt ? frame_fast_cycles / frame_fast_cnt : 0,
+			frame_slow_cnt,
+			frame_slow_cnt ? frame_slow_cycles / frame_slow_cnt : 0);
+	printf ("Reclaim: %lld wakeups, %lld frames reclaimed in background\n",
+			reclaim_wakeup_cnt, reclaim_frame_cnt);
+	rmap_print_stats ();
+}
+
+/* Wakes the reclaim daemon if free user frames fell below the low
+ * watermark and it is not already at work. */
+static void
+vm_reclaim_wake (void) {
+	enum intr_level old_level;
+
+	if (reclaim_disabled || palloc_user_free_cnt () >= reclaim_low)
+		return;
+
+	old_level = intr_disable ();
+	if (!reclaim_running) {
+		reclaim_running = true;
+		reclaim_wakeup_cnt++;
+		sema_up (&reclaim_sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* Reclaim daemon. Sleeps until woken by vm_reclaim_wake(), then evicts
+ * frames in batches, yielding between batches, until the high watermark
+ * is reached or nothing more can be evicted. */
+static void
+vm_reclaimd (void *aux UNUSED) {
+	for (;;) {
+		bool progress = true;
+
+		sema_down (&reclaim_sema);
+		while (progress && palloc_user_free_cnt () < reclaim_high) {
+			int i;
+
+			for (i = 0; i < RECLAIM_BATCH; i++) {
+				struct frame *frame = vm_evict_frame ();
+				if (frame == NULL) {
+					progress = false;
+					break;
+				}
+				vm_free_frame (frame);
+				reclaim_frame_cnt++;
+			}
+			thread_yield ();
+		}
+		reclaim_running = false;
+	}
+}
+
+/* Pins the frame that holds PAGE, if any, so that it is neither evicted
+ * nor freed until vm_unpin_frame(). Lets another thread, such as the
+ * writeback daemon, read the frame without holding any lock.
+ * Returns the frame, or NULL if PAGE is not resident. */
+struct frame *
+vm_pin_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Drops a pin taken on FRAME. */
+void
+vm_unpin_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	if (--frame->pin_cnt == 0)
+		cond_broadcast (&frame_unpinned, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Unlinks PAGE from its frame and removes its mapping from the current
+ * page table, first waiting for any pins on the frame to drop. The frame
+ * goes back to the user pool unless other processes still share it
+ * through the text table. Does nothing if PAGE is not resident. */
+void
+vm_release_frame (struct page *page) {
+	struct frame *frame;
+	bool last;
+
+	/* Eviction may take the frame away while we wait. */
+	lock_acquire (&frame_lock);
+	while ((frame = page->frame) != NULL && frame->pin_cnt > 0)
+		cond_wait (&frame_unpinned, &frame_lock);
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return;
+	}
+	rmap_remove (frame, thread_current ()->pml4, page);
+	page->frame = NULL;
+	if (frame->page == page)
+		frame->page = NULL;
+	last = text_release (frame);
+	if (last)
+		frame_table_remove (frame);
+	lock_release (&frame_lock);
+
+	if (last)
+		vm_free_frame (frame);
+}
+
+/* Gives back FRAME, just obtained from vm_get_frame() and still unused,
+ * when claiming a page into it fails. */
+static void
+vm_put_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame_table_remove (frame);
+	lock_release (&frame_lock);
+	vm_free_frame (frame);
+}
+
+/* Returns FRAME to the user pool. FRAME must be out of the frame table
+ * and the shared text table, and nothing may map it any longer. */
+static void
+vm_free_frame (struct frame *frame) {
+	ASSERT (frame->page == NULL);
+	ASSERT (frame->text_inode == NULL);
+	ASSERT (list_empty (&frame->rmap));
+
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
@@ -130,14 +492,118 @@ vm_handle_wp (struct page *page UNUSED) {
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr,
+		bool user UNUSED, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
 
-	return vm_do_claim_page (page);
+	/* A fault on a present page is a protection violation. */
+	if (addr == NULL || !is_user_vaddr (addr) || !not_present)
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL || (write && !page->writable))
+		return false;
+
+	if (!vm_do_claim_page (page))
+		return false;
+	if (page->advice == VM_ADV_SEQUENTIAL)
+		vm_fault_around (spt, page->va);
+	return true;
+}
+
+/* Claims up to FAULT_AROUND_PAGES non-resident pages that follow VA, so a
+ * sequential scan takes one fault per window instead of one per page.
+ * Stops at the first hole in SPT or at the first page that fails to claim. */
+static void
+vm_fault_around (struct supplemental_page_table *spt, void *va) {
+	uint8_t *upage = (uint8_t *) pg_round_down (va) + PGSIZE;
+	int i;
+
+	for (i = 0; i < FAULT_AROUND_PAGES && is_user_vaddr (upage);
+			i++, upage += PGSIZE) {
+		struct page *page = spt_find_page (spt, upage);
+		if (page == NULL)
+			break;
+		if (page->frame == NULL && !vm_do_claim_page (page))
+			break;
+	}
+}
+
+/* Throws away the contents of PAGE for VM_ADV_DONTNEED.
+ * A file-backed page is written back and unmapped, so the next access
+ * reloads it from the file. An anonymous page loses its frame and swap
+ * slot and becomes a lazily zero-filled page again. Pages that have never
+ * been loaded have nothing to drop. */
+static void
+vm_discard_page (struct page *page) {
+	enum vm_advice advice = page->advice;
+	struct hash_elem spt_elem = page->spt_elem;
+	bool writable = page->writable;
+	void *va = page->va;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return;
+
+	if (VM_TYPE (page->operations->type) == VM_FILE) {
+		if (page->frame != NULL && swap_out (page))
+			vm_release_frame (page);
+		return;
+	}
+
+	if (page->frame != NULL)
+		vm_release_frame (page);
+	destroy (page);
+	/* uninit_new() rewrites the whole page, links into the SPT included. */
+	uninit_new (page, va, NULL, VM_ANON, NULL, anon_initializer);
+	page->spt_elem = spt_elem;
+	page->writable = writable;
+	page->advice = advice;
+}
+
+/* Applies ADVICE to the LENGTH bytes starting at page-aligned ADDR, which
+ * must be entirely covered by the current process's SPT.
+ * VM_ADV_WILLNEED claims the non-resident pages of the range right away and
+ * VM_ADV_DONTNEED drops them; the other hints are remembered per page and
+ * consulted at fault and eviction time.
+ * Returns true on success, false if the range is invalid. */
+bool
+do_madvise (void *addr, size_t length, enum vm_advice advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr;
+	uint8_t *end = start + length;
+	uint8_t *upage;
+
+	if (pg_ofs (addr) != 0 || length == 0 || end < start
+			|| !is_user_vaddr (start) || !is_user_vaddr (end - 1))
+		return false;
+	if (advice < VM_ADV_NORMAL || advice > VM_ADV_DONTNEED)
+		return false;
+
+	/* Validate the whole range before changing anything. */
+	for (upage = start; upage < end; upage += PGSIZE)
+		if (spt_find_page (spt, upage) == NULL)
+			return false;
+
+	for (upage = start; upage < end; upage += PGSIZE) {
+		struct page *page = spt_find_page (spt, upage);
+
+		switch (advice) {
+			case VM_ADV_NORMAL:
+			case VM_ADV_RANDOM:
+			case VM_ADV_SEQUENTIAL:
+				page->advice = advice;
+				break;
+			case VM_ADV_WILLNEED:
+				if (page->frame == NULL)
+					vm_do_claim_page (page);
+				break;
+			case VM_ADV_DONTNEED:
+				vm_discard_page (page);
+				break;
+		}
+	}
+	return true;
 }
 
 /* Free the page.
@@ -150,10 +616,11 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
@@ -161,19 +628,37 @@ vm_claim_page (void *va UNUSED) {
 static bool
 vm_do_claim_page (struct page *page) {
 	struct frame *frame = vm_get_frame ();
+	uint64_t *pml4 = thread_current ()->pml4;
 
 	/* Set links */
 	frame->page = page;
 	page->frame = frame;
+	if (!rmap_add (frame, pml4, page))
+		goto fail;
+
+	/* Insert page table entry to map page's VA to frame's PA. The frame
+	 * stays pinned until it is loaded, so eviction cannot find it
+	 * half-filled through the mapping. */
+	if (!pml4_set_page (pml4, page->va, frame->kva, page->writable)
+			|| !swap_in (page, frame->kva)) {
+		rmap_remove (frame, pml4, page);
+		goto fail;
+	}
+	vm_unpin_frame (frame);
+	return true;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-
-	return swap_in (page, frame->kva);
+fail:
+	page->frame = NULL;
+	frame->page = NULL;
+	vm_put_frame (frame);
+	return false;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, spt_hash, spt_less, NULL);
+	spt->exec = NULL;
 }
 
 /* Copy supplemental page table from src to dst */
@@ -184,7 +669,39 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Destroying a page writes back its contents if they are file backed
+	 * and gives up its frame, dropping its share of a text frame. The
+	 * table stays usable, since process_exec() loads a new image into it.
+	 * Mappings go first, so that their files are closed. */
+	file_unmap_all (spt);
+	hash_clear (&spt->pages, spt_destroy_page);
+
+	/* No page is left to load from the executable. */
+	file_close (spt->exec);
+	spt->exec = NULL;
+}
+
+/* Returns a hash value for the page E. */
+static uint64_t
+spt_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+/* Returns true if page A has a lower address than B. */
+static bool
+spt_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page *a = hash_entry (a_, struct page, spt_elem);
+	const struct page *b = hash_entry (b_, struct page, spt_elem);
+
+	return a->va < b->va;
+}
+
+/* Frees the page E as its SPT is torn down. */
+static void
+spt_destroy_page (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
 }